@@ -0,0 +1,53 @@
+#include "arena.hpp"
+
+#include <algorithm>
+#include <new>
+
+namespace kn {
+
+static_assert(sizeof(Function) % alignof(Value) == 0, "arguments must be aligned after their node");
+
+Arena::~Arena() {
+	each([](Function& node) {
+		// Nested nodes are in this arena, and never held a reference to it.
+		for (size_t i = 0; i < node.arity; ++i)
+			if (node.args()[i].kind() != Value::Kind::Function)
+				node.args()[i].~Value();
+	});
+
+	while (chunk)
+		::operator delete(std::exchange(chunk, chunk->previous));
+}
+
+void* Arena::allocate(size_t size) {
+	if (!chunk || chunk->capacity - chunk->used < size) {
+		auto capacity = chunk ? std::min(chunk->capacity * 2, MAX_CHUNK_SIZE) : FIRST_CHUNK_SIZE;
+		capacity = std::max(capacity, size);
+
+		KN_COUNT_REFCOUNT(allocations);
+		chunk = new (::operator new(sizeof(Chunk) + capacity)) Chunk { chunk, 0, capacity };
+	}
+
+	auto memory = chunk->memory() + chunk->used;
+	chunk->used += size;
+	return memory;
+}
+
+Function* Arena::create(funcptr_t func, char name, size_t arity, bool pure) {
+	auto node = new (allocate(sizeof(Function) + arity * sizeof(Value))) Function(func, name, arity, pure, *this);
+
+	for (size_t i = 0; i < arity; ++i)
+		new (node->args() + i) Value();
+
+	return node;
+}
+
+void Arena::adopt(Value& argument, Value value) noexcept {
+	argument = std::move(value);
+
+	// The node that `argument` belongs to is in this arena too.
+	if (argument.kind() == Value::Kind::Function)
+		release();
+}
+
+} // namespace kn
@@ -0,0 +1,95 @@
+#pragma once
+
+#include "shared.hpp"
+#include "function.hpp"
+
+namespace kn {
+
+// The memory that a parsed program's `Function` nodes are allocated from.
+//
+// Each node is immediately followed by its arguments, and nodes are laid out in the order they're
+// parsed (parents before their children), so walking the tree mostly moves forwards through memory.
+// Nodes are never freed individually: every `Value` referring to one of an arena's nodes holds a
+// reference to the whole arena, which frees them all at once when the last of those is dropped.
+//
+// Nodes' own arguments don't hold references (or the arena could never be freed), so a node must
+// only ever have nodes from the same arena as arguments.
+class Arena : public RefCounted {
+	// A block of memory that nodes are allocated from.
+	struct Chunk {
+		// The chunk that was allocated before this one, if any.
+		Chunk* previous;
+
+		// How many bytes of `memory` have been used, and how many there are in total.
+		size_t used;
+		size_t capacity;
+
+		char* memory() noexcept { return reinterpret_cast<char*>(this + 1); }
+	};
+
+	// The first chunk is small, as most `EVAL`ed programs are. Each one after is twice the size of
+	// the last, up to the maximum.
+	static constexpr size_t FIRST_CHUNK_SIZE = 256;
+	static constexpr size_t MAX_CHUNK_SIZE = 64 * 1024;
+
+	// The chunk that's currently being allocated from.
+	Chunk* chunk = nullptr;
+
+	// Returns `size` bytes from the current chunk, allocating a new one if it's full.
+	void* allocate(size_t size);
+
+	// Calls `func` with each node in the arena.
+	template<typename F>
+	void each(F&& func) {
+		for (auto current = chunk; current; current = current->previous) {
+			for (size_t offset = 0; offset < current->used; ) {
+				auto node = reinterpret_cast<Function*>(current->memory() + offset);
+				func(*node);
+				offset += node->size();
+			}
+		}
+	}
+
+	// Scripts freeze the arguments of every node.
+	friend class Script;
+
+public:
+
+	Arena() noexcept = default;
+	~Arena();
+
+	Arena(Arena const&) = delete;
+	Arena& operator=(Arena const&) = delete;
+
+	// Creates a node for `func`, whose arguments are all null until they're `adopt`ed.
+	Function* create(funcptr_t func, char name, size_t arity, bool pure);
+
+	// Stores `value` as one of the arguments of a node in this arena.
+	void adopt(Value& argument, Value value) noexcept;
+
+	void retain() noexcept {
+		KN_COUNT_REFCOUNT(increments);
+
+		if (refcount != IMMORTAL)
+			++refcount;
+	}
+
+	void release() noexcept {
+		KN_COUNT_REFCOUNT(decrements);
+
+		if (refcount != IMMORTAL && --refcount == 0)
+			delete this;
+	}
+
+	// Makes the arena immortal, returning it so that it can be deleted explicitly. If it's already
+	// immortal, `nullptr` is returned instead.
+	RefCounted* make_immortal() noexcept {
+		if (refcount == IMMORTAL)
+			return nullptr;
+
+		refcount = IMMORTAL;
+		return this;
+	}
+};
+
+} // namespace kn
@@ -0,0 +1,105 @@
+#include "batch.hpp"
+#include "output.hpp"
+#include "input.hpp"
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace kn {
+
+Batch::Batch(std::string const& directory, Engine engine) : engine(engine) {
+	std::error_code error;
+
+	for (auto const& entry : std::filesystem::directory_iterator(directory, error)) {
+		if (entry.is_regular_file() && entry.path().extension() == ".kn")
+			scripts.push_back(Script { entry.path().string(), 0, {} });
+	}
+
+	if (error)
+		throw Error("unable to read directory '" + directory + "': " + error.message());
+
+	std::sort(scripts.begin(), scripts.end(), [](auto const& lhs, auto const& rhs) {
+		return lhs.path < rhs.path;
+	});
+}
+
+void Batch::run_script(Script& script) const {
+	std::ifstream file(script.path);
+	std::ostringstream contents;
+	contents << file.rdbuf();
+	auto source = contents.str();
+
+	int fd = open((script.path + ".out").c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+	if (fd == -1) {
+		script.status = 1;
+		script.error = "unable to open output file.";
+		return;
+	}
+
+	{
+		// The interpreter's destroyed before its streams, and the output's flushed when it is.
+		Output output(fd);
+		Input input { std::string_view() };
+		Interpreter interpreter(output, input);
+
+		try {
+			interpreter.play(source, engine);
+		} catch (Quit& quit) {
+			script.status = quit.status;
+		} catch (std::exception& err) {
+			script.status = 1;
+			script.error = err.what();
+		}
+	}
+
+	close(fd);
+}
+
+void Batch::work() {
+	for (size_t index; (index = next.fetch_add(1, std::memory_order_relaxed)) < scripts.size(); )
+		run_script(scripts[index]);
+}
+
+int Batch::run(size_t jobs) {
+	jobs = std::clamp<size_t>(jobs, 1, std::max<size_t>(scripts.size(), 1));
+
+	// This thread works too, so one fewer needs to be started.
+	std::vector<std::thread> workers;
+	for (size_t i = 1; i < jobs; ++i)
+		workers.emplace_back([this] { work(); });
+
+	work();
+
+	for (auto& worker : workers)
+		worker.join();
+
+	auto& output = Output::standard();
+	int status = 0;
+
+	for (auto const& script : scripts) {
+		output.write((number) script.status);
+		output.write('\t');
+		output.write(script.path);
+
+		if (!script.error.empty()) {
+			output.write('\t');
+			output.write(script.error);
+		}
+
+		output.write('\n');
+
+		if (script.status != 0)
+			status = 1;
+	}
+
+	output.flush();
+	return status;
+}
+
+} // namespace kn
@@ -0,0 +1,56 @@
+#pragma once
+
+#include "interpreter.hpp"
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+namespace kn {
+
+// Runs every Knight script (`*.kn`) in a directory, spread across a pool of threads (`--batch`).
+//
+// Each script is run in its own `Interpreter`, with an empty stdin, and its stdout written to
+// `<script>.out`. Nothing is shared between scripts, so they run entirely in parallel; threads just
+// take the next script that hasn't been started until there are none left.
+class Batch {
+	// A script, and how running it went.
+	struct Script {
+		std::string path;
+
+		// The status it exited with: `0` if it finished, its argument if it `QUIT`, `1` if it errored.
+		int status = 0;
+
+		// The error message, if it errored.
+		std::string error;
+	};
+
+	// The scripts to run, sorted by path.
+	std::vector<Script> scripts;
+
+	// How the scripts should be run.
+	Engine const engine;
+
+	// The index of the next script that hasn't been started.
+	std::atomic<size_t> next { 0 };
+
+	// Runs `script` to completion, recording how it went.
+	void run_script(Script& script) const;
+
+	// Runs scripts until there are none left.
+	void work();
+
+public:
+	// Finds all the scripts in `directory`.
+	//
+	// Throws an `Error` if `directory` can't be read.
+	Batch(std::string const& directory, Engine engine);
+
+	// Runs all the scripts using `jobs` threads, then writes each one's status and path (and error, if
+	// it had one) to stdout, one per line.
+	//
+	// Returns `0` if every script exited with a status of `0`, and `1` otherwise.
+	int run(size_t jobs);
+};
+
+} // namespace kn
@@ -0,0 +1,111 @@
+#include "command.hpp"
+
+#include <sstream>
+#include <cerrno>
+#include <fcntl.h>
+#include <spawn.h>
+#include <sys/ioctl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char** environ;
+
+namespace kn {
+
+// How much to read at a time when the pipe doesn't say how much is waiting in it.
+static constexpr size_t READ_SIZE = 4096;
+
+Command::Command(string command) : command(std::move(command)) {
+	int pipes[2];
+
+	if (pipe2(pipes, O_CLOEXEC) == -1)
+		throw Error("unable to execute command.");
+
+	// The command's stdout is the write end of the pipe. (`dup2` clears `O_CLOEXEC` on the copy.)
+	posix_spawn_file_actions_t actions;
+	posix_spawn_file_actions_init(&actions);
+	posix_spawn_file_actions_adddup2(&actions, pipes[1], STDOUT_FILENO);
+
+	char const* argv[] = { "sh", "-c", this->command.c_str(), nullptr };
+
+	started = std::chrono::steady_clock::now();
+	int status = posix_spawn(&pid, "/bin/sh", &actions, nullptr, const_cast<char**>(argv), environ);
+	spawning = std::chrono::steady_clock::now() - started;
+
+	posix_spawn_file_actions_destroy(&actions);
+	close(pipes[1]);
+
+	if (status != 0) {
+		close(pipes[0]);
+		throw Error("unable to execute command.");
+	}
+
+	output = pipes[0];
+}
+
+Command::~Command() {
+	// Only commands that were never finished are left; make sure they don't become zombies.
+	if (output != -1) {
+		close(output);
+		waitpid(pid, nullptr, 0);
+	}
+}
+
+string Command::read_output() {
+	string result;
+	size_t length = 0;
+
+	while (true) {
+		// Size the string to exactly what's waiting in the pipe, so it's read straight into place.
+		int waiting = 0;
+		if (ioctl(output, FIONREAD, &waiting) == -1 || waiting <= 0)
+			waiting = READ_SIZE;
+
+		result.resize(length + waiting);
+		auto amount = read(output, &result[length], waiting);
+
+		if (amount < 0 && errno == EINTR)
+			continue;
+
+		if (amount < 0)
+			throw Error("unable to read command stream");
+
+		if (amount == 0)
+			break;
+
+		length += amount;
+	}
+
+	result.resize(length);
+	return result;
+}
+
+string Command::finish() {
+	auto result = read_output();
+
+	close(output);
+	output = -1;
+
+	while (waitpid(pid, nullptr, 0) == -1) {
+		if (errno != EINTR)
+			throw Error("unable to close command stream.");
+	}
+
+	if (timed) {
+		using std::chrono::duration;
+		auto waiting = std::chrono::steady_clock::now() - started;
+
+		// This may be on a background thread (see `Pending`), so it's written in a single call.
+		std::ostringstream message;
+		message << "command '" << command << "': spawn "
+			<< duration<double, std::milli>(spawning).count() << "ms, wait "
+			<< duration<double, std::milli>(waiting).count() << "ms\n";
+
+		auto text = message.str();
+		::write(STDERR_FILENO, text.data(), text.length());
+	}
+
+	return result;
+}
+
+} // namespace kn
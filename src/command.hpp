@@ -0,0 +1,49 @@
+#pragma once
+
+#include "value.hpp"
+
+#include <chrono>
+#include <sys/types.h>
+
+namespace kn {
+
+// A shell command started by `` ` ``, whose stdout is read through a pipe.
+//
+// Commands are started with `posix_spawn` rather than `popen`, so the interpreter's (potentially
+// large) address space isn't copied just to exec `/bin/sh`.
+class Command {
+	// The command itself; used only when printing timings.
+	string const command;
+
+	// The shell that's running the command.
+	pid_t pid;
+
+	// The read end of the pipe connected to the command's stdout.
+	int output;
+
+	// When the command was started, and how long starting it took.
+	std::chrono::steady_clock::time_point started;
+	std::chrono::steady_clock::duration spawning;
+
+	// Whether to print how long each command took to stderr.
+	static inline bool timed = false;
+
+	// Reads everything the command writes to its stdout.
+	string read_output();
+
+public:
+	// Starts running `command` with `/bin/sh -c`.
+	explicit Command(string command);
+	~Command();
+
+	Command(Command const&) = delete;
+	Command& operator=(Command const&) = delete;
+
+	// Reads all of the command's output and waits for it to exit, returning the output.
+	string finish();
+
+	// Sets whether to print how long each command took to spawn and to finish to stderr.
+	static void set_timed(bool timed) noexcept { Command::timed = timed; }
+};
+
+} // namespace kn
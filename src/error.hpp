@@ -11,4 +11,11 @@ struct Error : public std::runtime_error {
 	explicit Error(std::string const& what_arg) : std::runtime_error(what_arg) {};
 };
 
+// Thrown by `QUIT` to stop the program with the given status.
+//
+// This isn't an `Error`, as quitting isn't one; whatever runs the interpreter should catch it.
+struct Quit {
+	int status;
+};
+
 } // namespace kn
@@ -1,289 +1,236 @@
 #include "function.hpp"
+#include "arena.hpp"
 #include "value.hpp"
 #include "variable.hpp"
 #include "shared.hpp"
-#include "knight.hpp"
-#include "include/robin_hood_map.hpp"
+#include "interpreter.hpp"
+#include "output.hpp"
+#include "input.hpp"
+#include "command.hpp"
+#include "pending.hpp"
 
-#include <iostream>
 #include <cstdio>
-#include <random>
 
 namespace kn {
 
-// The list of all _functions_
-static robin_hood::unordered_map<char, std::pair<funcptr_t, size_t>> FUNCTIONS;
-
-std::optional<Value> Function::parse(std::string_view& view) {
-	char front = view.front();
+Function* Function::parse(std::string_view& view, Interpreter const& interpreter, Arena& arena) {
+	auto entry = interpreter.find_function(view.front());
 
 	// if the first character isn't a valid function Variable, then just return early.
-	if (FUNCTIONS.count(front) == 0)
-		return std::nullopt;
+	if (!entry)
+		return nullptr;
 
+	char name = view.front();
 	view.remove_prefix(1);
 
-	auto func_pair = FUNCTIONS[front];
-
 	// remove trailing upper-case letters for keyword functions.
-	if (isupper(front)) {
-		while (isupper(view.front()) || view.front() == '_')
+	if (entry->keyword) {
+		while (!view.empty() && (('A' <= view.front() && view.front() <= 'Z') || view.front() == '_'))
 			view.remove_prefix(1);
 	}
 
-	// parse the arguments out.
-	args_t args;
-	for(size_t i = 0; i < func_pair.second; ++i) {
-		auto value = Value::parse(view);
-
-		if (!value)
-			throw Error("Cannot parse function.");
-
-		args.push_back(*value);
-	}
-
-	return std::make_optional<Value>(make_shared<Function>(Function(func_pair.first, front, args)));
+	// the function's allocated before its arguments, so they come after it in the arena.
+	return arena.create(entry->func, name, entry->arity, entry->pure);
 }
 
-void Function::register_function(char name, size_t arity, funcptr_t func) {
-	FUNCTIONS.insert({ name, std::make_pair(func, arity) });
-}
-
-std::ostream& operator<<(std::ostream& out, Function const& func) {
-	out << "Function(" << func.name;
+Value Function::finish(Interpreter& interpreter) {
+	// the folded function's left in the arena, unused, as nothing's ever freed individually. Its
+	// arguments are all literals though, so they're released now rather than with the arena.
+	if (folding && pure) {
+		if (auto folded = fold(interpreter)) {
+			for (size_t i = 0; i < arity; ++i)
+				args()[i] = Value();
 
-	for (auto arg : func.args)
-		out << ", " << arg;
+			return std::move(*folded);
+		}
+	}
 
-	return out << ")";
+	return Value(this);
 }
 
-
 // Prompts for a single line from stdin.
-static Value prompt(args_t&) {
-	string line;
-	std::getline(std::cin, line);
+static Value prompt(args_t) {
+	auto& interpreter = Interpreter::current();
+	interpreter.output().flush(); // so that anything prompting for this line is visible.
 
-	if (std::cin.eof() && line.length() == 0)
-		return Value();
-
-	if (line.length() != 0 && line.back() == '\r')
-		line.pop_back();
-
-	return Value(line);
+	return interpreter.input().read_line();
 }
 
 // Gets a random number.
-static Value random(args_t&) {
-	static thread_local std::random_device rd;
-	static thread_local std::mt19937 gen(rd());
-	static thread_local std::uniform_int_distribution<number> dist;
-
-	return Value((number) dist(gen));
+static Value random(args_t) {
+	return Value(Interpreter::current().random());
 }
 
 // Creates a block of code.
-static Value block(args_t& args) {
+static Value block(args_t args) {
 	return args[0];
 }
 
 // Calls a block of code.
-static Value call(args_t& args) {
+static Value call(args_t args) {
 	return args[0].run().run();
 }
 
 // Evaluates the argument as Knight source code.
 #ifndef KN_NEXTENSIONS
-static Value eval(args_t& args) {
+static Value eval(args_t args) {
 	auto code = args[0].run().to_string();
-	return kn::play(std::string_view(*code));
+	return Interpreter::current().play(code.as_string());
 }
 
 // Runs a shell command, returns the stdout of the command.
-// effectively copied my C impl...
-static Value system(args_t& args) {
-	auto cmd = args[0].run().to_string();
-	FILE *stream = popen(cmd->c_str(), "r");
-
-	if (stream == NULL) {
-		throw Error("unable to execute command.");
-	}
-
-	size_t cap = 2048;
-	size_t length = 0;
-	size_t tmp;
-
-	char *result = (char *) malloc(cap);
-	if (result == NULL) {
-		throw Error("cant malloc");
-	}
-
-	while (0 != (tmp = fread((char *) (((size_t) result) + length), 1, cap - length, stream))) {
-		length += tmp;
-		if (length == cap) {
-			cap *= 2;
-			result = (char *) realloc(result, cap);
-			if (result == NULL) {
-				throw Error("cannot realloc");
-			}
-		}
-	}
+//
+// If prefetching is enabled, this returns as soon as the command's started; see `Pending`.
+static Value system(args_t args) {
+	auto cmd = string(args[0].run().to_string().as_string());
+	Interpreter::current().output().flush(); // the command's own output must come after ours.
 
-	// ignore any errors with the es
-	if (ferror(stream)) {
-		throw Error("unable to read command stream");
-	}
+	auto command = std::make_unique<Command>(std::move(cmd));
 
-	if (pclose(stream) == -1) {
-		throw Error("unable to close command stream.");
-	}
+	if (Pending::is_enabled())
+		return Value(kn::make_shared<Pending>(std::move(command)));
 
-	return Value(string(result));
+	return Value(command->finish());
 }
 #endif /* !KN_NEXTENSIONS */
 
 // Stops the program with the given status code.
-static Value quit(args_t& args) {
-	exit(args[0].run().to_number());
+static Value quit(args_t args) {
+	auto status = args[0].run().to_number();
+	Interpreter::current().output().flush();
+	throw Quit { (int) status };
 }
 
 // Logical negation of its argument.
-static Value not_(args_t& args) {
+static Value not_(args_t args) {
 	return Value((bool) !args[0].run().to_boolean());
 }
 
 // Returns the length of the argument, when converted to a string.
-static Value length(args_t& args) {
-	return Value((number) args[0].run().to_list()->size());
+static Value length(args_t args) {
+	return Value((number) args[0].run().list_length());
 }
 
 // Returns the length of the argument, when converted to a string.
-static Value dump(args_t& args) {
+static Value dump(args_t args) {
 	auto arg = args[0].run();
-	std::cout << arg;
+	auto& output = Interpreter::current().output();
+	output.stream() << arg;
+	output.flush_line();
 	return arg;
 }
 
 // Runs the value, then converts it to a string and prints it. The execution result is returned.
 //
 // If the string ends with a backslash, its removed before printing. Otherwise, a newline is added.
-static Value output(args_t& args) {
-	auto str = args[0].run().to_string();
-
-	if (!str->empty() && str->back() == '\\') {
-		str->pop_back(); // delete the trailing backslash
-		std::cout << *str;
-		str->push_back('\\'); // add it back
-	} else {
-		std::cout << *str << std::endl;
-	}
+static Value output(args_t args) {
+	Interpreter::current().output().output(args[0].run());
 
 	return Value();
 }
 
 // Gets the ascii value if the first argument.
-static Value ascii(args_t& args) {
+static Value ascii(args_t args) {
 	return args[0].run().to_ascii();
 }
 
 // Negates the first argument.
-static Value negate(args_t& args) {
+static Value negate(args_t args) {
 	return -args[0].run();
 }
 
-static Value box(args_t& args) {
+static Value box(args_t args) {
 	return Value(list{args[0].run()});
 }
 
-static Value head(args_t& args) {
+static Value head(args_t args) {
 	return args[0].run().head();
 }
 
-static Value tail(args_t& args) {
+static Value tail(args_t args) {
 	return args[0].run().tail();
 }
 
 // Adds two values together.
-static Value add(args_t& args) {
+static Value add(args_t args) {
 	return args[0].run() + args[1].run();
 }
 
 // Subtracts the second value from the first.
-static Value sub(args_t& args) {
+static Value sub(args_t args) {
 	return args[0].run() - args[1].run();
 }
 
 // Multiplies the two values together.
-static Value mul(args_t& args) {
+static Value mul(args_t args) {
 	return args[0].run() * args[1].run();
 }
 // Divides the first value by the second.
-static Value div(args_t& args) {
+static Value div(args_t args) {
 	return args[0].run() / args[1].run();
 }
 
 // Modulos the first value by the second.
-static Value mod(args_t& args) {
+static Value mod(args_t args) {
 	return args[0].run() % args[1].run();
 }
 
 // Raises the first value to the power of the second.
-static Value pow(args_t& args) {
+static Value pow(args_t args) {
 	return args[0].run().pow(args[1].run());
 }
 
 // Checks to see if the two values are equal.
-static Value eql(args_t& args) {
+static Value eql(args_t args) {
 	return Value(args[0].run() == args[1].run());
 }	
 
 // Checks to see if the first value is less than the second.
-static Value lth(args_t& args) {
+static Value lth(args_t args) {
 	return Value(args[0].run() < args[1].run());
 }
 
 // Checks to see if the first value is greater than the second.
-static Value gth(args_t& args) {
+static Value gth(args_t args) {
 	return Value(args[0].run() > args[1].run());
 }
 
 // Evaluates the first value, returning it if it's falsey. Otherwise evaluates and returns the second.
-static Value and_(args_t& args) {
+static Value and_(args_t args) {
 	auto lhs = args[0].run();
 
 	return lhs.to_boolean() ? args[1].run() : lhs;
 }
 
 // Evaluates the first value, returning it if it's truthy. Otherwise evaluates and returns the second.
-static Value or_(args_t& args) {
+static Value or_(args_t args) {
 	auto lhs = args[0].run();
 
 	return lhs.to_boolean() ? lhs : args[1].run();
 }
 
 // Runs the first value, then runs the second and returns it.
-static Value then(args_t& args) {
+static Value then(args_t args) {
 	args[0].run();
 
 	return args[1].run();
 }
 
 // Assigns the second value to the first.
-static Value assign(args_t& args) {
+static Value assign(args_t args) {
 	auto variable = args[0].as_variable();
 
-	if (variable == nullptr)
-		throw Error("cannot assign to non-variables");
-
-	auto value = args[1].run();
-	variable->assign(value);
+	auto value = args[1].kind() == Value::Kind::Function
+		? args[1].as_function()->run_assigning(variable)
+		: args[1].run();
+	variable.assign(value);
 	return value;
 }
 
 // Evaluates the second value while the first one is truthy.
 //
 // The last value the body returned will be returned. If the body never ran, null will be returned.
-static Value while_(args_t& args) {
+static Value while_(args_t args) {
 	while (args[0].run().to_boolean())
 		args[1].run();
 
@@ -291,14 +238,14 @@ static Value while_(args_t& args) {
 }
 
 // Runs the second value if the first is truthy. Otherwise, runs the third value.
-static Value if_(args_t& args) {
+static Value if_(args_t args) {
 	return args[1 + !args[0].run().to_boolean()].run();
 }
 
 // Returns a substring of the first value, with the second value as the start index and the third as the length.
 //
 // If the length is out of bounds, it's assumed to be the string length.
-static Value get(args_t& args) {
+static Value get(args_t args) {
 	auto container = args[0].run();
 	auto start = args[1].run().to_number();
 	auto length = args[2].run().to_number();
@@ -307,54 +254,187 @@ static Value get(args_t& args) {
 }
 
 // Returns a new string with first string's range `[second, second+third)` replaced by the fourth value.
-static Value substitute(args_t& args) {
+static Value substitute(args_t args) {
 	auto container = args[0].run();
 	auto start = args[1].run().to_number();
 	auto length = args[2].run().to_number();
 	auto replacement = args[3].run();
 
-	return container.set(start, length, replacement);
-}
-
-void Function::initialize(void) {
-	Function::register_function('P', 0, &prompt);
-	Function::register_function('R', 0, &random);
-
-	Function::register_function('B', 1, &block);
-	Function::register_function('C', 1, &call);
-	Function::register_function('E', 1, &eval);
-
-	Function::register_function('`', 1, &system);
-	Function::register_function('Q', 1, &quit);
-	Function::register_function('!', 1, &not_);
-	Function::register_function('L', 1, &length);
-	Function::register_function('D', 1, &dump);
-	Function::register_function('O', 1, &output);
-	Function::register_function('A', 1, &ascii);
-	Function::register_function('~', 1, &negate);
-	Function::register_function(',', 1, &box);
-	Function::register_function('[', 1, &head);
-	Function::register_function(']', 1, &tail);
-
-	Function::register_function('+', 2, &add);
-	Function::register_function('-', 2, &sub);
-	Function::register_function('*', 2, &mul);
-	Function::register_function('/', 2, &div);
-	Function::register_function('%', 2, &mod);
-	Function::register_function('^', 2, &pow);
-	Function::register_function('?', 2, &eql);
-	Function::register_function('<', 2, &lth);
-	Function::register_function('>', 2, &gth);
-	Function::register_function('&', 2, &and_);
-	Function::register_function('|', 2, &or_);
-	Function::register_function(';', 2, &then);
-	Function::register_function('=', 2, &assign);
-	Function::register_function('W', 2, &while_);
-
-	Function::register_function('I', 3, &if_);
-	Function::register_function('G', 3, &get);
-
-	Function::register_function('S', 4, &substitute);
+	return std::move(container).set(start, length, std::move(replacement));
+}
+
+Value Function::run_assigning(Variable variable) const {
+	bool updates_variable = (func == &add || func == &mul || func == &substitute)
+		&& args()[0].kind() == Value::Kind::Variable && args()[0].as_variable() == variable;
+
+	if (!updates_variable)
+		return run();
+
+	Value operands[4];
+	for (size_t i = 0; i < arity; ++i)
+		operands[i] = args()[i].run();
+
+	// The variable's about to be overwritten, so nothing can observe its old value being dropped.
+	variable.assign(Value());
+
+	try {
+		if (func == &add)
+			return std::move(operands[0]) + operands[1];
+
+		if (func == &mul)
+			return std::move(operands[0]) * operands[1];
+
+		auto start = operands[1].to_number();
+		auto length = operands[2].to_number();
+		return std::move(operands[0]).set(start, length, std::move(operands[3]));
+	} catch (...) {
+		// Operations only update their operand in place once they can't fail, so it's unchanged.
+		variable.assign(std::move(operands[0]));
+		throw;
+	}
+}
+
+// Whether `value` is a literal, which is always its own result when run.
+static bool is_literal(Value const& value) noexcept {
+	switch (value.kind()) {
+	case Value::Kind::Null:
+	case Value::Kind::Boolean:
+	case Value::Kind::Number:
+	case Value::Kind::SmallString:
+	case Value::Kind::String:
+	case Value::Kind::List:
+		return true;
+
+	default:
+		return false;
+	}
+}
+
+// Converts the result of a folded function into a literal, flattening ropes, slices, and list trees
+// so that programs only ever contain the kinds that `Script`s know how to freeze.
+//
+// A folded function's arguments are all literals, so any lists in its result only contain literals
+// too, and never need converting themselves.
+static std::optional<Value> to_literal(Value const& value, Interpreter& interpreter) {
+	switch (value.kind()) {
+	case Value::Kind::Null:
+	case Value::Kind::Boolean:
+	case Value::Kind::Number:
+	case Value::Kind::SmallString:
+		return value;
+
+	case Value::Kind::String:
+	case Value::Kind::Rope:
+	case Value::Kind::Slice:
+		if (Function::MAX_FOLDED_LENGTH < value.as_string().length())
+			return std::nullopt;
+
+		return interpreter.intern(value.as_string());
+
+	case Value::Kind::List:
+		if (Function::MAX_FOLDED_LENGTH < value.list_length())
+			return std::nullopt;
+
+		return value;
+
+	case Value::Kind::ListTree:
+		if (Function::MAX_FOLDED_LENGTH < value.list_length())
+			return std::nullopt;
+
+		return Value(value.to_list());
+
+	default:
+		return std::nullopt;
+	}
+}
+
+std::optional<Value> Function::fold(Interpreter& interpreter) const {
+	for (size_t i = 0; i < arity; ++i)
+		if (!is_literal(args()[i]))
+			return std::nullopt;
+
+	try {
+		// `*` is the only way to make a result that's much longer than its arguments, so it's checked
+		// before it's run rather than after.
+		if (func == &mul && args()[0].kind() != Value::Kind::Number) {
+			auto length = args()[0].list_length();
+			auto count = args()[1].to_number();
+
+			// Replicating is linear in the count, even when the result is empty.
+			if (count < 0 || MAX_FOLDED_LENGTH < (size_t) count
+					|| (length != 0 && MAX_FOLDED_LENGTH / length < (size_t) count))
+				return std::nullopt;
+		}
+
+		return to_literal(run(), interpreter);
+	} catch (std::exception&) {
+		return std::nullopt;
+	}
+}
+
+std::ostream& operator<<(std::ostream& out, Function const& func) {
+	out << "Function(" << func.name;
+
+	for (size_t i = 0; i < func.arity; ++i)
+		out << ", " << func.args()[i];
+
+	return out << ")";
+}
+
+
+// The builtin functions, indexed by name.
+static constexpr Function::Table BUILTINS = [] {
+	Function::Table table {};
+
+	auto define = [&](char name, size_t arity, funcptr_t func, bool pure = false) {
+		table[(unsigned char) name] = Function::Entry { func, (uint32_t) arity, 'A' <= name && name <= 'Z', pure };
+	};
+
+	define('P', 0, &prompt);
+	define('R', 0, &random);
+
+	define('B', 1, &block);
+	define('C', 1, &call);
+#ifndef KN_NEXTENSIONS
+	define('E', 1, &eval);
+	define('`', 1, &system);
+#endif /* !KN_NEXTENSIONS */
+	define('Q', 1, &quit);
+	define('!', 1, &not_, true);
+	define('L', 1, &length, true);
+	define('D', 1, &dump);
+	define('O', 1, &output);
+	define('A', 1, &ascii, true);
+	define('~', 1, &negate, true);
+	define(',', 1, &box, true);
+	define('[', 1, &head, true);
+	define(']', 1, &tail, true);
+
+	define('+', 2, &add, true);
+	define('-', 2, &sub, true);
+	define('*', 2, &mul, true);
+	define('/', 2, &div, true);
+	define('%', 2, &mod, true);
+	define('^', 2, &pow, true);
+	define('?', 2, &eql, true);
+	define('<', 2, &lth, true);
+	define('>', 2, &gth, true);
+	define('&', 2, &and_, true);
+	define('|', 2, &or_, true);
+	define(';', 2, &then, true);
+	define('=', 2, &assign);
+	define('W', 2, &while_);
+
+	define('I', 3, &if_, true);
+	define('G', 3, &get, true);
+
+	define('S', 4, &substitute, true);
+
+	return table;
+}();
+
+Function::Table const& Function::builtins() noexcept {
+	return BUILTINS;
 }
 
 } // namespace kn
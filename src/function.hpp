@@ -1,58 +1,137 @@
 #pragma once
 
 #include "value.hpp"
-#include "include/small_vector.hpp"
+
+#include <array>
 
 namespace kn {
 
-// The argument type that functions must accept.
-using args_t = itlib::small_vector<Value, 4>;
+class Arena;
+
+// The arguments that functions are given: their unevaluated argument values.
+using args_t = Value const*;
 
 // The pointer type that all functions must fulfill.
-using funcptr_t = Value(*)(args_t&);
+using funcptr_t = Value(*)(args_t);
 
 // The class that represents a function and its arguments within Knight.
+//
+// Functions are allocated in the `Arena` of the program they were parsed from, with their arguments
+// stored directly after them.
 class Function {
 	// A pointer to the function associated with this class.
 	funcptr_t const func;
 
+	// The arena that this function was allocated in.
+	Arena& arena;
+
+	// How many arguments follow this function.
+	uint32_t const arity;
+
 	// The name of the function; used only within `DUMP`.
 	char const name;
 
-	// The unevaluated arguments associated with this function.
-	args_t args;
+	// Whether it can be folded once its arguments are parsed (see `Entry::pure`).
+	bool const pure;
 
-	// Creates a function with the given function and arguments.
+	// Creates a function with the given function and arity; its arguments are created separately.
 	//
 	// This is private because the only way to create a `Function` is through `parse`.
-	Function(funcptr_t func, char name, args_t args): func(func), name(name), args(args) {}
+	Function(funcptr_t func, char name, size_t arity, bool pure, Arena& arena) noexcept
+		: func(func), arena(arena), arity((uint32_t) arity), name(name), pure(pure) {}
+
+	// Whether functions are folded when they're parsed.
+	static inline bool folding = true;
+
+	// Returns the result of running this (pure) function as a literal, if its arguments are all
+	// literals. If running it fails, it's left to fail (or not) when the program's run.
+	std::optional<Value> fold(Interpreter& interpreter) const;
+
+	// Returns what this function parses as, once all of its arguments have been parsed: its result
+	// if it can be folded, and itself otherwise.
+	Value finish(Interpreter& interpreter);
+
+	// Returns how many bytes this function and its arguments take up.
+	size_t size() const noexcept { return sizeof(Function) + arity * sizeof(Value); }
+
+	// The unevaluated arguments associated with this function.
+	Value* args() noexcept { return reinterpret_cast<Value*>(this + 1); }
+	Value const* args() const noexcept { return reinterpret_cast<Value const*>(this + 1); }
+
+	// Arenas create functions, and values keep their arenas alive.
+	friend class Arena;
+	friend class Value;
+
+	// The bytecode compiler needs to inspect the tree directly.
+	friend class Program;
+
+	// Scripts make the arguments immortal.
+	friend class Script;
 
 public:
 
+	// How a function is parsed.
+	struct Entry {
+		// What the function calls, or `nullptr` if there's no function with this name.
+		funcptr_t func = nullptr;
+
+		// How many arguments it takes.
+		uint32_t arity = 0;
+
+		// Whether it's a keyword (eg `WHILE`), whose name continues with upper case letters and `_`.
+		bool keyword = false;
+
+		// Whether it can be evaluated when it's parsed, if its arguments are all literals: it has no
+		// side effects, and always returns the same thing given the same arguments.
+		bool pure = false;
+	};
+
+	// Every function that can be parsed, indexed by their (single character) names.
+	using Table = std::array<Entry, 256>;
+
 	// You cannot default construct Functions--you must use `parse`.
 	Function() = delete;
 
-	// Attempts to parse a `Function` instance from the `string_view`.
-	//
-	// If the first character of `view` isn't a known `Function` name, `nullptr` is returned.
-	static std::optional<Value> parse(std::string_view& view);
+	Function(Function const&) = delete;
+	Function& operator=(Function const&) = delete;
 
-	// Registers a new funciton with the given name, arity, and function pointer.
+	// Attempts to parse a function's name from the `string_view`, allocating it in `arena`.
 	//
-	// Any previous function associated with `name` will be silently discarded.
-	static void register_function(char name, size_t arity, funcptr_t func);
+	// Its arguments are all null; they're parsed (and given to the function) by `Value::parse`, and
+	// then it's `finish`ed. If the first character of `view` isn't one of `interpreter`'s
+	// functions, `nullptr` is returned.
+	static Function* parse(std::string_view& view, Interpreter const& interpreter, Arena& arena);
+
+	// Returns the table of builtin functions, which is built at compile time.
+	static Table const& builtins() noexcept;
+
+	// Returns whether pure functions with literal arguments are replaced by their results when
+	// they're parsed.
+	static bool is_folding() noexcept { return folding; }
 
-	// Registers all builtin functions.
-	static void initialize();
+	// Sets whether pure functions should be folded; disabling it leaves the tree as it was written,
+	// which is useful for debugging (eg with `DUMP`).
+	static void set_folding(bool folding) noexcept { Function::folding = folding; }
+
+	// Folded strings and lists longer than this are left unfolded, as the result is kept for as long
+	// as the program is (and may be far larger than the source, eg `* "x" 1000000000`).
+	static constexpr size_t MAX_FOLDED_LENGTH = 4096;
 
 	// Executes this function, returning the result of the execution.
-	Value run() { // not marked const because `args` may be modified (eg `=`)
-		return func(args);
+	Value run() const {
+		return func(args());
 	}
 
+	// Executes this function for `= variable <this>`.
+	//
+	// When this is `+`, `*`, or `S` with `variable` as its first argument, the variable's reference to
+	// its old value is dropped just before the operation, so that (eg) `= s + s "x"` can append to
+	// the string in place if nothing else refers to it.
+	Value run_assigning(Variable variable) const;
+
 	// Checks to see if two functions are equal.
 	bool operator==(const Function& rhs) const noexcept {
-		return this == (Function*) &rhs;
+		return this == &rhs;
 	}
 
 	// Returns debugging information about this type.
@@ -0,0 +1,112 @@
+#include "input.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace kn {
+
+Input::Input(int fd) noexcept : fd(fd) {
+	struct stat info;
+
+	if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size != 0) {
+		auto offset = lseek(fd, 0, SEEK_CUR);
+		auto mapped = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+		if (offset >= 0 && mapped != MAP_FAILED) {
+			madvise(mapped, info.st_size, MADV_SEQUENTIAL);
+			mapping = mapped;
+			mapping_length = info.st_size;
+			cursor = static_cast<char const*>(mapping) + std::min<size_t>(offset, mapping_length);
+			end = static_cast<char const*>(mapping) + mapping_length;
+			eof = true; // there's nothing to read beyond the mapping.
+			return;
+		}
+
+		if (mapped != MAP_FAILED)
+			munmap(mapped, info.st_size);
+	}
+
+	buffer = std::make_unique<char[]>(CAPACITY);
+}
+
+Input::Input(std::string_view contents) noexcept
+	: fd(-1), cursor(contents.data()), end(contents.data() + contents.length()), eof(true)
+{}
+
+Input::~Input() {
+	if (mapping)
+		munmap(mapping, mapping_length);
+}
+
+Input& Input::standard() {
+	static Input input(STDIN_FILENO);
+	return input;
+}
+
+bool Input::refill() {
+	while (!eof) {
+		auto amount = ::read(fd, buffer.get(), CAPACITY);
+
+		if (amount < 0 && errno == EINTR)
+			continue;
+
+		if (amount <= 0) {
+			eof = true;
+			break;
+		}
+
+		cursor = buffer.get();
+		end = cursor + amount;
+		return true;
+	}
+
+	return false;
+}
+
+// Strips a trailing `\r` from `line`, if it has one.
+static std::string_view strip_carriage_return(std::string_view line) {
+	if (!line.empty() && line.back() == '\r')
+		line.remove_suffix(1);
+
+	return line;
+}
+
+Value Input::read_line() {
+	// Lines that are split across blocks are assembled here.
+	string line;
+	bool partial = false;
+
+	while (cursor != end || refill()) {
+		auto newline = static_cast<char const*>(std::memchr(cursor, '\n', end - cursor));
+
+		if (newline == nullptr) {
+			line.append(cursor, end);
+			partial = true;
+			cursor = end;
+			continue;
+		}
+
+		std::string_view rest(cursor, newline - cursor);
+		cursor = newline + 1;
+
+		if (!partial)
+			return Value(strip_carriage_return(rest));
+
+		line.append(rest);
+		break;
+	}
+
+	if (!partial)
+		return Value();
+
+	if (!line.empty() && line.back() == '\r')
+		line.pop_back();
+
+	return Value(std::move(line));
+}
+
+} // namespace kn
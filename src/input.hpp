@@ -0,0 +1,58 @@
+#pragma once
+
+#include "value.hpp"
+
+#include <memory>
+#include <cstddef>
+
+namespace kn {
+
+// A line reader in front of a file descriptor or a block of memory, used by `P`.
+//
+// When the input is a regular file, it's mapped into memory and lines are copied straight out of
+// the mapping. Otherwise, it's read in blocks of `CAPACITY` bytes. Either way, newlines are found
+// with `memchr` (which is vectorized), and each line's string is only constructed once.
+class Input {
+public:
+	// How many bytes are read at a time when the input can't be mapped.
+	static constexpr size_t CAPACITY = 64 * 1024;
+
+private:
+	// Where the input is read from; `-1` when reading from memory.
+	int const fd;
+
+	// The unread part of the mapping or buffer.
+	char const* cursor = nullptr;
+	char const* end = nullptr;
+
+	// The mapped file, if the input could be mapped.
+	void* mapping = nullptr;
+	size_t mapping_length = 0;
+
+	// The buffer that blocks are read into, if it couldn't.
+	std::unique_ptr<char[]> buffer;
+
+	// Set once there's nothing left to read, so that terminals aren't read from again.
+	bool eof = false;
+
+	// Reads the next block into `buffer`, returning whether anything was read.
+	bool refill();
+
+public:
+	explicit Input(int fd) noexcept;
+
+	// Reads lines out of `contents`, which must outlive the input.
+	explicit Input(std::string_view contents) noexcept;
+	~Input();
+
+	Input(Input const&) = delete;
+	Input& operator=(Input const&) = delete;
+
+	// The reader in front of stdin.
+	static Input& standard();
+
+	// Reads the next line, without its trailing `\n` or `\r\n`. Returns null if there are no more.
+	Value read_line();
+};
+
+} // namespace kn
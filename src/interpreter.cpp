@@ -0,0 +1,143 @@
+#include "interpreter.hpp"
+#include "variable.hpp"
+#include "output.hpp"
+#include "input.hpp"
+#include "vm.hpp"
+#include "script.hpp"
+#include "arena.hpp"
+
+namespace kn {
+
+thread_local Interpreter* Interpreter::running = nullptr;
+
+Interpreter::Interpreter(Output& output, Input& input)
+	: functions(Function::builtins()), out(&output), in(&input), generator(std::random_device()())
+{}
+
+Interpreter::Interpreter() : Interpreter(Output::standard(), Input::standard()) {}
+
+Interpreter::Interpreter(Script const& script, Output& output, Input& input) : Interpreter(output, input) {
+	base = &script.compiler;
+	slots.resize(base->slots.size());
+}
+
+Interpreter::~Interpreter() = default;
+
+// Restores whichever interpreter was running before, even if this one throws.
+struct Interpreter::Running {
+	Interpreter* previous;
+
+	explicit Running(Interpreter* interpreter) noexcept : previous(running) { running = interpreter; }
+	~Running() { running = previous; }
+};
+
+Value Interpreter::play(std::string_view view, Engine engine) {
+	auto program = parse(view);
+
+	if (engine == Engine::Vm) {
+		auto compiled = Program::compile(program);
+		return run(compiled);
+	}
+
+	return run(program);
+}
+
+Value Interpreter::parse(std::string_view view) {
+	// The parser's reference to the arena, which is dropped once the program holds its own (or it
+	// fails to parse).
+	struct Parsing {
+		Arena* arena = new Arena();
+		~Parsing() { arena->release(); }
+	} parsing;
+
+	auto value = Value::parse(view, *this, *parsing.arena);
+
+	if (!value)
+		throw Error("nothing to parse.");
+
+	return *value;
+}
+
+Value Interpreter::run(Value const& program) {
+	Running guard(this);
+	return program.run();
+}
+
+Value Interpreter::run(Program const& program) {
+	Running guard(this);
+	return program.run();
+}
+
+Value Interpreter::run(Script const& script) {
+	if (base != &script.compiler)
+		throw Error("a script can only be run by an interpreter created for it.");
+
+	return script.compiled ? run(*script.compiled) : run(script.tree);
+}
+
+void Interpreter::register_function(char name, size_t arity, funcptr_t func) {
+	functions[(unsigned char) name] = Function::Entry { func, (uint32_t) arity, 'A' <= name && name <= 'Z' };
+}
+
+std::optional<Variable> Interpreter::find(std::string_view name) const {
+	if (base) {
+		if (auto match = base->environment.find(name); match != base->environment.cend())
+			return Variable(match->second);
+	}
+
+	if (auto match = environment.find(name); match != environment.cend())
+		return Variable(match->second);
+
+	return std::nullopt;
+}
+
+Variable Interpreter::lookup(std::string_view name) {
+	if (auto variable = find(name))
+		return *variable;
+
+	environment.emplace(std::string_view(names.emplace_back(name)), slots.size());
+	slots.emplace_back();
+
+	return Variable(slots.size() - 1);
+}
+
+std::string_view Interpreter::name(size_t slot) const noexcept {
+	auto inherited = base ? base->slots.size() : 0;
+
+	return slot < inherited ? base->name(slot) : names[slot - inherited];
+}
+
+Value const& Interpreter::get(std::string_view name) {
+	auto variable = find(name);
+
+	if (!variable)
+		throw Error("unknown variable encountered: " + std::string(name));
+
+	return variable->run(*this);
+}
+
+void Interpreter::set(std::string_view name, Value value) {
+	lookup(name).assign(*this, std::move(value));
+}
+
+Value Interpreter::intern(std::string_view str) {
+	if (str.length() <= Value::SMALL_STRING_CAPACITY)
+		return Value(str);
+
+	if (auto match = literals.find(str); match != literals.cend())
+		return Value(match->second);
+
+	auto literal = kn::make_shared<string>(str);
+	literals.emplace(std::string_view(*literal), literal);
+	return Value(literal);
+}
+
+number Interpreter::random() {
+	return std::uniform_int_distribution<number>()(generator);
+}
+
+void Interpreter::reseed() {
+	generator.seed(std::random_device()());
+}
+
+} // namespace kn
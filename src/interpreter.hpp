@@ -0,0 +1,167 @@
+#pragma once
+
+#include "value.hpp"
+#include "function.hpp"
+#include "include/robin_hood_map.hpp"
+
+#include <deque>
+#include <memory>
+#include <optional>
+#include <random>
+#include <vector>
+
+namespace kn {
+
+class Output;
+class Input;
+class Program;
+class Script;
+
+// The different ways a parsed program can be executed.
+enum class Engine {
+	// Walks the `Value` tree directly; this is the reference implementation.
+	Tree,
+
+	// Compiles the tree to bytecode first, then runs it on a stack VM.
+	Vm,
+};
+
+// A Knight interpreter, and everything that a program run by it can change.
+//
+// Each interpreter has its own variables, functions, streams, and random number generator, so
+// separate interpreters can run on separate threads at the same time. A single interpreter (and
+// any values it produces) must only ever be used from one thread at a time, as `shared`'s refcounts
+// aren't atomic.
+class Interpreter {
+	// The functions that can be parsed, indexed by name. This starts out as `Function::builtins`.
+	Function::Table functions;
+
+	// The slot of every variable that's been referenced, keyed by name.
+	//
+	// As per the Knight specs, all variables are global (to the interpreter). Their slots are only
+	// meaningful to the interpreter that parsed them, and interpreters running its `Script`.
+	robin_hood::unordered_map<std::string_view, size_t> environment;
+
+	// The names of this interpreter's own variables, in the order of their slots (which start after
+	// `base`'s). It's a deque so that `environment`'s keys can refer to them.
+	std::deque<std::string> names;
+
+	// The interpreter that parsed the `Script` this one runs, if any. Its variables are looked up
+	// before this one's own (which it never changes), so that `EVAL` finds the same slots.
+	Interpreter const* base = nullptr;
+
+	// The values of every variable, including `base`'s, indexed by their slots.
+	std::vector<std::optional<Value>> slots;
+
+	// String literals that are too long to be stored inline.
+	//
+	// Identical literals (eg in generated code, or from `EVAL`ing the same source repeatedly) all
+	// share the same allocation. The table always holds a reference, so these strings are never
+	// uniquely owned.
+	robin_hood::unordered_map<std::string_view, shared<string>> literals;
+
+	// Where `OUTPUT` and `DUMP` write to, and where `PROMPT` reads from.
+	Output* out;
+	Input* in;
+
+	// The generator used by `RANDOM`.
+	std::mt19937 generator;
+
+	// The interpreter that's running on this thread, if any.
+	static thread_local Interpreter* running;
+
+	// Makes an interpreter the `current` one until it's destroyed.
+	struct Running;
+
+public:
+	// Creates an interpreter with all the builtin functions, which uses the given streams.
+	explicit Interpreter(Output& output, Input& input);
+
+	// Creates an interpreter which uses stdout and stdin.
+	Interpreter();
+
+	// Creates an interpreter for running `script` (and only `script`), which uses the given streams.
+	//
+	// It must be destroyed before `script` is.
+	Interpreter(Script const& script, Output& output, Input& input);
+	~Interpreter();
+
+	Interpreter(Interpreter const&) = delete;
+	Interpreter& operator=(Interpreter const&) = delete;
+
+	// Runs the input as Knight source code, returning its result.
+	//
+	// Calls may be nested (eg by `EVAL`); the innermost one is the `current` interpreter.
+	Value play(std::string_view view, Engine engine = Engine::Tree);
+
+	// Parses the input as Knight source code, so that it can be run (any number of times) later.
+	//
+	// Throws an `Error` if there's nothing to parse.
+	Value parse(std::string_view view);
+
+	// Runs a program that was parsed, or parsed and compiled, by this interpreter.
+	Value run(Value const& program);
+	Value run(Program const& program);
+
+	// Runs the script this interpreter was created for.
+	Value run(Script const& script);
+
+	// Returns the interpreter that's currently running on this thread.
+	//
+	// This is how builtin functions find their streams and such; it must only be called whilst
+	// `play` or `run` is running.
+	static Interpreter& current() noexcept { return *running; }
+
+	// Registers a new function with the given name, arity, and function pointer.
+	//
+	// Any previous function associated with `name` will be silently discarded.
+	void register_function(char name, size_t arity, funcptr_t func);
+
+	// Returns the function associated with `name`, or `nullptr` if there is none.
+	Function::Entry const* find_function(char name) const noexcept {
+		auto const& entry = functions[(unsigned char) name];
+		return entry.func ? &entry : nullptr;
+	}
+
+	// Looks up the variable associated with `name`, or creates it if it doesnt exist.
+	Variable lookup(std::string_view name);
+
+	// Looks up the variable associated with `name`, without creating it if it doesn't exist.
+	std::optional<Variable> find(std::string_view name) const;
+
+	// Returns the name of the variable in `slot`.
+	std::string_view name(size_t slot) const noexcept;
+
+	// Returns the storage for the variable in `slot`; it's empty if the variable's unassigned.
+	std::optional<Value>& slot(size_t slot) noexcept { return slots[slot]; }
+
+	// Returns the value of the variable `name`. Throws an `Error` if it's unassigned, or if there's
+	// no such variable (which isn't created).
+	Value const& get(std::string_view name);
+
+	// Assigns `value` to the variable `name`.
+	void set(std::string_view name, Value value);
+
+	// Returns a string value for the literal `str`, sharing storage with identical literals.
+	Value intern(std::string_view str);
+
+	// Returns a random non-negative number.
+	number random();
+
+	// Reseeds the random number generator, so that forked copies of an interpreter don't all
+	// generate the same numbers.
+	void reseed();
+
+	// The streams that this interpreter uses.
+	Output& output() noexcept { return *out; }
+	Input& input() noexcept { return *in; }
+
+	// Changes the streams that this interpreter uses, eg to run a new program with what an old one
+	// left in its variables.
+	void redirect(Output& output, Input& input) noexcept {
+		out = &output;
+		in = &input;
+	}
+};
+
+} // namespace kn
@@ -0,0 +1,181 @@
+#include "libknight.h"
+#include "interpreter.hpp"
+#include "output.hpp"
+#include "input.hpp"
+#include "vm.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <optional>
+
+// Used when the caller doesn't want a program's output.
+static void discard(void*, char const*, size_t) {}
+
+// Identifies each interpreter, even after another's been allocated where a freed one was.
+static std::atomic<uint64_t> next_id { 0 };
+
+struct kn_interpreter {
+	uint64_t const id = next_id++;
+
+	// What the interpreter uses when it isn't running a program: nothing's written, and there's
+	// nothing to read. The host process's own stdin and stdout are never touched.
+	kn::Output idle_output { discard, nullptr };
+	kn::Input idle_input { std::string_view() };
+
+	kn::Interpreter interpreter { idle_output, idle_input };
+
+	// The message of the last `KN_ERROR`.
+	std::string error;
+};
+
+struct kn_program {
+	// The `id` of the interpreter that parsed the program, the only one with its variables' slots.
+	uint64_t owner;
+
+	kn::Value tree;
+
+	// Set when the program's run by the VM.
+	std::optional<kn::Program> compiled;
+};
+
+// Runs `body`, converting any exception it throws into a status.
+template<typename F>
+static kn_status guard(kn_interpreter* interpreter, F&& body) noexcept {
+	try {
+		return body();
+	} catch (std::bad_alloc&) {
+		return KN_NO_MEMORY;
+	} catch (std::exception& err) {
+		try {
+			interpreter->error = err.what();
+		} catch (std::bad_alloc&) {
+			return KN_NO_MEMORY;
+		}
+
+		return KN_ERROR;
+	}
+}
+
+kn_interpreter* kn_interpreter_new() {
+	try {
+		return new kn_interpreter();
+	} catch (std::bad_alloc&) {
+		return nullptr;
+	}
+}
+
+void kn_interpreter_free(kn_interpreter* interpreter) {
+	delete interpreter;
+}
+
+char const* kn_last_error(kn_interpreter const* interpreter) {
+	return interpreter->error.c_str();
+}
+
+kn_status kn_parse(kn_interpreter* interpreter, char const* source, size_t length, kn_engine engine, kn_program** program) {
+	*program = nullptr;
+
+	return guard(interpreter, [&] {
+		auto parsed = std::make_unique<kn_program>(kn_program {
+			interpreter->id, interpreter->interpreter.parse(std::string_view(source, length)), std::nullopt
+		});
+
+		if (engine == KN_ENGINE_VM)
+			parsed->compiled.emplace(kn::Program::compile(parsed->tree));
+
+		*program = parsed.release();
+		return KN_OK;
+	});
+}
+
+void kn_program_free(kn_program* program) {
+	delete program;
+}
+
+kn_status kn_run(kn_interpreter* interpreter, kn_program* program, char const* input, size_t length,
+	kn_output_fn output, void* data, int* exit_status)
+{
+	if (exit_status)
+		*exit_status = 0;
+
+	return guard(interpreter, [&] {
+		if (program->owner != interpreter->id)
+			throw kn::Error("program was parsed by a different interpreter.");
+
+		// The output's buffer is large, and callers' threads may have small stacks. It's flushed when
+		// it's destroyed, even if the program errors.
+		auto out = std::make_unique<kn::Output>(output ? output : discard, data);
+		kn::Input in(std::string_view(input, length));
+		interpreter->interpreter.redirect(*out, in);
+
+		// The streams don't outlive this call, so the interpreter's pointed back at its idle ones
+		// before they're destroyed.
+		struct Restore {
+			kn_interpreter* interpreter;
+			~Restore() { interpreter->interpreter.redirect(interpreter->idle_output, interpreter->idle_input); }
+		} restore { interpreter };
+
+		try {
+			if (program->compiled)
+				interpreter->interpreter.run(*program->compiled);
+			else
+				interpreter->interpreter.run(program->tree);
+		} catch (kn::Quit& quit) {
+			if (exit_status)
+				*exit_status = quit.status;
+
+			return KN_QUIT;
+		}
+
+		return KN_OK;
+	});
+}
+
+kn_status kn_set_number(kn_interpreter* interpreter, char const* name, int64_t value) {
+	return guard(interpreter, [&] {
+		interpreter->interpreter.set(name, kn::Value((kn::number) value));
+		return KN_OK;
+	});
+}
+
+kn_status kn_set_string(kn_interpreter* interpreter, char const* name, char const* value, size_t length) {
+	return guard(interpreter, [&] {
+		interpreter->interpreter.set(name, kn::Value(std::string_view(value, length)));
+		return KN_OK;
+	});
+}
+
+kn_status kn_get_number(kn_interpreter* interpreter, char const* name, int64_t* value) {
+	return guard(interpreter, [&] {
+		*value = interpreter->interpreter.get(name).to_number();
+		return KN_OK;
+	});
+}
+
+kn_status kn_get_string(kn_interpreter* interpreter, char const* name, char** value, size_t* length) {
+	*value = nullptr;
+
+	return guard(interpreter, [&] {
+		auto str = interpreter->interpreter.get(name).to_string();
+		auto contents = str.as_string();
+
+		auto copy = static_cast<char*>(std::malloc(contents.length() + 1));
+		if (!copy)
+			return KN_NO_MEMORY;
+
+		*std::copy(contents.cbegin(), contents.cend(), copy) = '\0';
+
+		*value = copy;
+		if (length)
+			*length = contents.length();
+
+		return KN_OK;
+	});
+}
+
+void kn_string_free(char* value) {
+	std::free(value);
+}
@@ -0,0 +1,101 @@
+#ifndef LIBKNIGHT_H
+#define LIBKNIGHT_H
+
+/* The C interface to the Knight interpreter, built as `libknight.so` by `make`.
+ *
+ * Programs are parsed once into a `kn_program`, which can then be run any number of times; each run
+ * only costs the evaluation. Everything belongs to a `kn_interpreter`, whose variables persist
+ * between runs and can be set and read from C. A program can only be run by the interpreter that
+ * parsed it; running it with another returns `KN_ERROR`. Separate interpreters can be used from
+ * separate threads at the same time, but a single interpreter (and its programs) must only be used
+ * by one thread at a time.
+ *
+ * Functions report failure by returning a `kn_status`, never by throwing. When it's `KN_ERROR`,
+ * `kn_last_error` describes what went wrong. */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define KN_API __attribute__((visibility("default")))
+
+typedef struct kn_interpreter kn_interpreter;
+typedef struct kn_program kn_program;
+
+typedef enum kn_status {
+	/* It worked. */
+	KN_OK = 0,
+
+	/* The program called `QUIT`; its exit status is returned separately. */
+	KN_QUIT = 1,
+
+	/* The source code was invalid, the program failed, or a variable was never assigned. */
+	KN_ERROR = 2,
+
+	/* Memory couldn't be allocated. */
+	KN_NO_MEMORY = 3,
+} kn_status;
+
+/* Which engine programs are run by. */
+typedef enum kn_engine {
+	KN_ENGINE_TREE = 0,
+	KN_ENGINE_VM = 1,
+} kn_engine;
+
+/* Receives a program's output, in blocks. `bytes` isn't nul-terminated. */
+typedef void (*kn_output_fn)(void *data, char const *bytes, size_t length);
+
+/* Creates a new interpreter, or returns `NULL` if memory couldn't be allocated. */
+KN_API kn_interpreter *kn_interpreter_new(void);
+
+/* Frees an interpreter and all of its variables. Its programs must be freed separately. */
+KN_API void kn_interpreter_free(kn_interpreter *interpreter);
+
+/* Returns a description of the last `KN_ERROR` that happened in `interpreter`, which is valid until
+ * the next call that's given `interpreter`. */
+KN_API char const *kn_last_error(kn_interpreter const *interpreter);
+
+/* Parses `length` bytes of `source`, storing the program in `*program`. `KN_ENGINE_VM` programs are
+ * also compiled to bytecode. */
+KN_API kn_status kn_parse(kn_interpreter *interpreter, char const *source, size_t length,
+	kn_engine engine, kn_program **program);
+
+/* Frees a program. This may be done after its interpreter's been freed. */
+KN_API void kn_program_free(kn_program *program);
+
+/* Runs `program`, with `length` bytes of `input` as its stdin (which may be `NULL` when `length` is
+ * zero). Its output is passed to `output` along with `data`; if `output` is `NULL`, it's discarded.
+ *
+ * If it calls `QUIT`, `KN_QUIT` is returned, and its argument is stored in `*exit_status` (when
+ * `exit_status` isn't `NULL`). Otherwise, `*exit_status` is set to `0`. */
+KN_API kn_status kn_run(kn_interpreter *interpreter, kn_program *program, char const *input,
+	size_t length, kn_output_fn output, void *data, int *exit_status);
+
+/* Assigns a number to the variable `name` (a nul-terminated string). */
+KN_API kn_status kn_set_number(kn_interpreter *interpreter, char const *name, int64_t value);
+
+/* Assigns `length` bytes of `value` to the variable `name` as a string. */
+KN_API kn_status kn_set_string(kn_interpreter *interpreter, char const *name, char const *value,
+	size_t length);
+
+/* Reads the variable `name`, converted to a number. Returns `KN_ERROR` if it's never been assigned
+ * (reading a variable doesn't create it). */
+KN_API kn_status kn_get_number(kn_interpreter *interpreter, char const *name, int64_t *value);
+
+/* Reads the variable `name`, converted to a string. `*value` is set to a nul-terminated copy of it
+ * (which must be freed with `kn_string_free`), and its length is stored in `*length` if `length`
+ * isn't `NULL`. Like `kn_get_number`, it returns `KN_ERROR` for unassigned variables. */
+KN_API kn_status kn_get_string(kn_interpreter *interpreter, char const *name, char **value,
+	size_t *length);
+
+/* Frees a string returned by `kn_get_string`. */
+KN_API void kn_string_free(char *value);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* LIBKNIGHT_H */
@@ -0,0 +1,294 @@
+#include "list_tree.hpp"
+
+#include <algorithm>
+
+namespace kn {
+
+ListTree::ListTree(list items) noexcept : height(0), length(items.size()), items(std::move(items)) {}
+
+ListTree::ListTree(size_t height, std::vector<node> children) noexcept
+	: height(height), length(0), children(std::move(children))
+{
+	ends.reserve(this->children.size());
+
+	for (auto const& child : this->children)
+		ends.push_back(length += child->length);
+}
+
+std::pair<size_t, size_t> ListTree::locate(size_t index) const {
+	size_t which = std::upper_bound(ends.cbegin(), ends.cend(), index) - ends.cbegin();
+	return { which, which == 0 ? 0 : ends[which - 1] };
+}
+
+Value const& ListTree::at(size_t index) const {
+	auto tree = this;
+
+	while (tree->height != 0) {
+		auto [which, offset] = tree->locate(index);
+		index -= offset;
+		tree = &*tree->children[which];
+	}
+
+	return tree->items[index];
+}
+
+void ListTree::collect(size_t start, size_t end, list& out) const {
+	if (height == 0) {
+		out.insert(out.end(), items.cbegin() + start, items.cbegin() + end);
+		return;
+	}
+
+	for (auto [which, offset] = locate(start); offset < end; offset = ends[which++]) {
+		auto const& child = *children[which];
+		auto from = start > offset ? start - offset : 0;
+		child.collect(from, std::min(end - offset, child.length), out);
+	}
+}
+
+list ListTree::flatten() const {
+	list out;
+	out.reserve(length);
+	collect(0, length, out);
+	return out;
+}
+
+void ListTree::each(std::function<void(Value const&)> const& func) const {
+	if (height == 0) {
+		for (auto const& item : items)
+			func(item);
+		return;
+	}
+
+	for (auto const& child : children)
+		child->each(func);
+}
+
+// Splits `count` entries into as few nodes as possible, as evenly as possible, calling `func` with
+// the start and end of each. When there's more than one node, they'll each have at least
+// `MIN_BRANCHING` entries.
+template<class F>
+static void each_group(size_t count, size_t branching, F const& func) {
+	auto groups = (count + branching - 1) / branching;
+
+	for (size_t i = 0; i < groups; ++i)
+		func(count * i / groups, count * (i + 1) / groups);
+}
+
+std::vector<ListTree::node> ListTree::pack_leaves(list::const_iterator begin, list::const_iterator end) {
+	std::vector<node> leaves;
+
+	each_group(end - begin, BRANCHING, [&](size_t start, size_t stop) {
+		leaves.push_back(kn::make_shared<ListTree>(list(begin + start, begin + stop)));
+	});
+
+	return leaves;
+}
+
+std::vector<ListTree::node> ListTree::pack(size_t height, std::vector<node> const& nodes) {
+	std::vector<node> branches;
+
+	each_group(nodes.size(), BRANCHING, [&](size_t start, size_t stop) {
+		branches.push_back(kn::make_shared<ListTree>(height,
+			std::vector<node>(nodes.cbegin() + start, nodes.cbegin() + stop)));
+	});
+
+	return branches;
+}
+
+ListTree::node ListTree::build(list::const_iterator begin, list::const_iterator end) {
+	auto nodes = pack_leaves(begin, end);
+
+	for (size_t height = 1; nodes.size() != 1; ++height)
+		nodes = pack(height, nodes);
+
+	return nodes[0];
+}
+
+ListTree::node ListTree::tree_of(Value const& lst) {
+	if (lst.kind() == Value::Kind::ListTree)
+		return lst.large.tree;
+
+	return build(lst.large.lst->cbegin(), lst.large.lst->cend());
+}
+
+// Combines two nodes of the same height. They're left alone if they're both full enough to be
+// children, otherwise their entries are redistributed into one or two new nodes.
+std::vector<ListTree::node> ListTree::merge(node const& lhs, node const& rhs) {
+	if (lhs->width() >= MIN_BRANCHING && rhs->width() >= MIN_BRANCHING)
+		return { lhs, rhs };
+
+	if (lhs->height == 0) {
+		list items;
+		items.reserve(lhs->items.size() + rhs->items.size());
+		items.insert(items.end(), lhs->items.cbegin(), lhs->items.cend());
+		items.insert(items.end(), rhs->items.cbegin(), rhs->items.cend());
+		return pack_leaves(items.cbegin(), items.cend());
+	}
+
+	std::vector<node> children;
+	children.reserve(lhs->children.size() + rhs->children.size());
+	children.insert(children.end(), lhs->children.cbegin(), lhs->children.cend());
+	children.insert(children.end(), rhs->children.cbegin(), rhs->children.cend());
+	return pack(lhs->height, children);
+}
+
+// Joins `rhs` onto the right edge of `lhs`, which must be at least as tall, returning one or two
+// nodes with the same height as `lhs`.
+std::vector<ListTree::node> ListTree::join_right(node const& lhs, node const& rhs) {
+	if (lhs->height == rhs->height)
+		return merge(lhs, rhs);
+
+	auto joined = join_right(lhs->children.back(), rhs);
+	std::vector<node> children(lhs->children.cbegin(), lhs->children.cend() - 1);
+	children.insert(children.end(), joined.cbegin(), joined.cend());
+	return pack(lhs->height, children);
+}
+
+// Joins `lhs` onto the left edge of `rhs`, which must be at least as tall, returning one or two
+// nodes with the same height as `rhs`.
+std::vector<ListTree::node> ListTree::join_left(node const& lhs, node const& rhs) {
+	if (lhs->height == rhs->height)
+		return merge(lhs, rhs);
+
+	auto children = join_left(lhs, rhs->children.front());
+	children.insert(children.end(), rhs->children.cbegin() + 1, rhs->children.cend());
+	return pack(rhs->height, children);
+}
+
+ListTree::node ListTree::join(node const& lhs, node const& rhs) {
+	auto nodes = lhs->height >= rhs->height ? join_right(lhs, rhs) : join_left(lhs, rhs);
+
+	if (nodes.size() == 1)
+		return nodes[0];
+
+	auto height = nodes[0]->height + 1;
+	return kn::make_shared<ListTree>(height, std::move(nodes));
+}
+
+// Returns the elements from `start` up to `end`, which must be nonempty, sharing whatever nodes of
+// `tree` lie entirely within it.
+ListTree::node ListTree::slice(node const& tree, size_t start, size_t end) {
+	if (start == 0 && end == tree->length)
+		return tree;
+
+	if (tree->height == 0)
+		return kn::make_shared<ListTree>(list(tree->items.cbegin() + start, tree->items.cbegin() + end));
+
+	auto [first, first_offset] = tree->locate(start);
+	auto [last, last_offset] = tree->locate(end - 1);
+	auto const& children = tree->children;
+
+	if (first == last)
+		return slice(children[first], start - first_offset, end - first_offset);
+
+	auto result = slice(children[first], start - first_offset, children[first]->length);
+
+	if (first + 1 == last - 1)
+		result = join(result, children[first + 1]);
+	else if (first + 1 < last)
+		result = join(result, kn::make_shared<ListTree>(tree->height,
+			std::vector<node>(children.cbegin() + first + 1, children.cbegin() + last)));
+
+	return join(result, slice(children[last], 0, end - last_offset));
+}
+
+Value ListTree::create(list lst) {
+	if (lst.size() <= FLAT_LENGTH)
+		return Value(std::move(lst));
+
+	return Value(build(lst.cbegin(), lst.cend()));
+}
+
+bool ListTree::append(Value& lst, list const& items) {
+	auto const& tree = lst.large.tree;
+
+	if (!tree.unique() || BRANCHING < items.size())
+		return false;
+
+	// The nodes along the right edge, from the root down to the last leaf.
+	std::vector<ListTree*> edge { &*tree };
+	while (edge.back()->height != 0) {
+		auto const& last = edge.back()->children.back();
+
+		if (!last.unique())
+			return false;
+
+		edge.push_back(&*last);
+	}
+
+	// The items go into the last leaf if there's room, and otherwise into a new leaf under the lowest
+	// branch that has room for another child. (Like a tail, that leaf's allowed to be small.)
+	auto parent = edge.size() - 1;
+
+	if (BRANCHING < edge.back()->items.size() + items.size()) {
+		do {
+			if (parent-- == 0)
+				return false;
+		} while (edge[parent]->children.size() == BRANCHING);
+	}
+
+	for (size_t i = 0; i < parent; ++i) {
+		edge[i]->length += items.size();
+		edge[i]->ends.back() += items.size();
+	}
+
+	auto& node = *edge[parent];
+	node.length += items.size();
+
+	if (node.height == 0) {
+		node.items.insert(node.items.end(), items.cbegin(), items.cend());
+		return true;
+	}
+
+	auto child = kn::make_shared<ListTree>(items);
+	for (size_t height = 1; height < node.height; ++height)
+		child = kn::make_shared<ListTree>(height, std::vector<ListTree::node> { std::move(child) });
+
+	node.children.push_back(std::move(child));
+	node.ends.push_back(node.length);
+	return true;
+}
+
+Value ListTree::concat(Value const& lhs, Value const& rhs) {
+	auto llen = lhs.list_length();
+	auto rlen = rhs.list_length();
+
+	if (rlen == 0)
+		return lhs;
+
+	if (llen == 0)
+		return rhs;
+
+	// Trees are always longer than `FLAT_LENGTH`, so both of these must be flat.
+	if (llen + rlen <= FLAT_LENGTH) {
+		list cat;
+		cat.reserve(llen + rlen);
+		cat.insert(cat.end(), lhs.large.lst->cbegin(), lhs.large.lst->cend());
+		cat.insert(cat.end(), rhs.large.lst->cbegin(), rhs.large.lst->cend());
+		return Value(std::move(cat));
+	}
+
+	return Value(join(tree_of(lhs), tree_of(rhs)));
+}
+
+Value ListTree::get(Value const& lst, size_t start, size_t length) {
+	if (lst.kind() == Value::Kind::List) {
+		auto const& flat = *lst.large.lst;
+		return create(list(flat.cbegin() + start, flat.cbegin() + start + length));
+	}
+
+	auto const& tree = lst.large.tree;
+
+	if (tree->length < start + length)
+		throw Error("index out of bounds");
+
+	if (length > FLAT_LENGTH)
+		return Value(slice(tree, start, start + length));
+
+	list out;
+	out.reserve(length);
+	tree->collect(start, start + length, out);
+	return Value(std::move(out));
+}
+
+} // namespace kn
@@ -0,0 +1,92 @@
+#pragma once
+
+#include "value.hpp"
+
+namespace kn {
+
+// A persistent list, stored as a relaxed radix balanced tree.
+//
+// Long lists are stored as these so that `G`, `S`, `]`, and `+` can share structure with the lists
+// they're given rather than copying them, taking `O(log n)` time instead of `O(n)`. Lists of up to
+// `FLAT_LENGTH` elements are always stored flat, as a plain `list`, since copying them is cheap.
+//
+// Every branch keeps a table of where each of its children ends, so children don't have to be
+// completely full. Instead, every node other than the root has between `MIN_BRANCHING` and
+// `BRANCHING` entries, which keeps the tree balanced however it's sliced up and joined back.
+class ListTree {
+	using node = shared<ListTree>;
+
+	// How far this node is from its leaves; leaves themselves have a height of zero.
+	size_t const height;
+
+	// The total amount of elements within this node.
+	size_t length;
+
+	// The elements of a leaf.
+	list items;
+
+	// The children of a branch, and the running total of their lengths.
+	std::vector<node> children;
+	std::vector<size_t> ends;
+
+	// Returns how many elements or children this node directly contains.
+	size_t width() const noexcept { return height == 0 ? items.size() : children.size(); }
+
+	// Returns which child contains the element at `index`, and where that child starts.
+	std::pair<size_t, size_t> locate(size_t index) const;
+
+	// Appends the elements from `start` up to `end` onto `out`.
+	void collect(size_t start, size_t end, list& out) const;
+
+	static node build(list::const_iterator begin, list::const_iterator end);
+	static node tree_of(Value const& lst);
+	static std::vector<node> pack_leaves(list::const_iterator begin, list::const_iterator end);
+	static std::vector<node> pack(size_t height, std::vector<node> const& nodes);
+	static std::vector<node> merge(node const& lhs, node const& rhs);
+	static std::vector<node> join_right(node const& lhs, node const& rhs);
+	static std::vector<node> join_left(node const& lhs, node const& rhs);
+	static node join(node const& lhs, node const& rhs);
+	static node slice(node const& tree, size_t start, size_t end);
+
+public:
+
+	// The most entries a node can have.
+	static constexpr size_t BRANCHING = 32;
+
+	// The fewest entries a node other than the root can have.
+	static constexpr size_t MIN_BRANCHING = BRANCHING / 2;
+
+	// Lists with at most this many elements are stored flat.
+	static constexpr size_t FLAT_LENGTH = BRANCHING;
+
+	explicit ListTree(list items) noexcept;
+	ListTree(size_t height, std::vector<node> children) noexcept;
+
+	// Returns the total amount of elements in the list.
+	size_t size() const noexcept { return length; }
+
+	// Returns the element at `index`, which must be within bounds.
+	Value const& at(size_t index) const;
+
+	// Returns a copy of every element in the list.
+	list flatten() const;
+
+	// Calls `func` with each element of the list, in order.
+	void each(std::function<void(Value const&)> const& func) const;
+
+	// Returns `lst` as a `Value`, stored as a tree if it's longer than `FLAT_LENGTH`.
+	static Value create(list lst);
+
+	// Appends `items` onto the end of the tree `lst` without copying it, if nothing else refers to it
+	// or to the nodes along its right edge, and there's room for them along that edge. Returns whether
+	// it could.
+	static bool append(Value& lst, list const& items);
+
+	// Concatenates two lists, either of which may be flat or a tree.
+	static Value concat(Value const& lhs, Value const& rhs);
+
+	// Returns the `length` elements of the list `lst` starting at `start`.
+	static Value get(Value const& lst, size_t start, size_t length);
+};
+
+} // namespace kn
@@ -1,31 +1,119 @@
 #include "knight.hpp"
+#include "output.hpp"
+#include "command.hpp"
+#include "pending.hpp"
+#include "batch.hpp"
+#include "server.hpp"
 #include <iostream>
 #include <fstream>
+#include <optional>
 #include <sstream>
+#include <thread>
 
 void usage(char const* program) {
-	std::cerr << "usage: " << program << " (-e 'expression' | -f file)" << std::endl;
+	std::cerr << "usage: " << program << " [--engine=(tree|vm)] [--line-buffered] [--time-commands] [--async-commands] [--no-fold] (-e 'expression' | -f file | (--batch directory | [--zygote prelude] --serve socket) [-j jobs])" << std::endl;
 	exit(1);
 }
 
+std::string read_file(char const* path) {
+	std::ifstream file(path);
+	std::ostringstream contents;
+	contents << file.rdbuf();
+	return contents.str();
+}
+
+#ifdef KN_REFCOUNT_STATS
+void print_refcount_stats() {
+	std::cerr << "refcount stats: "
+		<< kn::refcount_stats.allocations << " allocations, "
+		<< kn::refcount_stats.increments << " increments, "
+		<< kn::refcount_stats.decrements << " decrements" << std::endl;
+}
+#endif /* KN_REFCOUNT_STATS */
+
 int main(int argc, char **argv) {
-	if (argc != 3)
+	// Knight's output goes through `kn::Output`, so the standard streams needn't sync with stdio.
+	std::ios::sync_with_stdio(false);
+
+	auto engine = kn::Engine::Tree;
+	std::optional<std::string> batch, serve, zygote;
+	int i = 1;
+
+	for (; i < argc && std::string_view(argv[i]).substr(0, 2) == "--"; ++i) {
+		std::string_view flag(argv[i]);
+
+		if (flag == "--engine=tree")
+			engine = kn::Engine::Tree;
+		else if (flag == "--engine=vm")
+			engine = kn::Engine::Vm;
+		else if (flag == "--line-buffered")
+			kn::Output::standard().set_line_buffered(true);
+		else if (flag == "--time-commands")
+			kn::Command::set_timed(true);
+		else if (flag == "--async-commands")
+			kn::Pending::set_enabled(true);
+		else if (flag == "--no-fold")
+			kn::Function::set_folding(false);
+		else if (flag == "--batch" && i + 1 < argc)
+			batch = argv[++i];
+		else if (flag == "--serve" && i + 1 < argc)
+			serve = argv[++i];
+		else if (flag == "--zygote" && i + 1 < argc)
+			zygote = argv[++i];
+		else
+			usage(argv[0]);
+	}
+
+#ifdef KN_REFCOUNT_STATS
+	std::atexit(print_refcount_stats);
+#endif /* KN_REFCOUNT_STATS */
+
+	if (batch || serve) {
+		size_t jobs = std::thread::hardware_concurrency();
+
+		if (argc - i == 2 && std::string_view("-j") == argv[i])
+			jobs = std::strtoul(argv[i + 1], nullptr, 10);
+		else if (argc != i || (batch && serve) || (zygote && !serve))
+			usage(argv[0]);
+
+		try {
+			if (zygote) {
+				// Requests are run in forked copies of this, so the prelude's only run once.
+				kn::Interpreter prelude;
+				prelude.play(read_file(zygote->c_str()), engine);
+				kn::Server(*serve, engine, &prelude).run(jobs);
+			}
+
+			if (serve)
+				kn::Server(*serve, engine).run(jobs);
+
+			return kn::Batch(*batch, engine).run(jobs);
+		} catch (kn::Quit& quit) {
+			return quit.status;
+		} catch (std::exception& err) {
+			kn::Output::standard().flush();
+			std::cerr << "error: " << err.what() << std::endl;
+			return 1;
+		}
+	}
+
+	if (argc - i != 2)
 		usage(argv[0]);
 
-	kn::initialize();
+	kn::Interpreter interpreter;
 
 	try {
-		if (std::string_view("-e") == argv[1])  {
-			kn::play(argv[2]);
-		} else if (std::string_view("-f") == argv[1]) {
-			std::ifstream file(argv[2]);
-			std::ostringstream contents;
-			contents << file.rdbuf();
-			kn::play(contents.str());
+		if (std::string_view("-e") == argv[i])  {
+			interpreter.play(argv[i + 1], engine);
+		} else if (std::string_view("-f") == argv[i]) {
+			interpreter.play(read_file(argv[i + 1]), engine);
 		} else {
 			usage(argv[0]);
 		}
+	} catch (kn::Quit& quit) {
+		return quit.status;
 	} catch (std::exception& err) {
+		kn::Output::standard().flush();
 		std::cerr << "error with your code: " << err.what() << std::endl;
 		return 1;
 	}
@@ -0,0 +1,204 @@
+#include "output.hpp"
+
+#include <charconv>
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+
+namespace kn {
+
+Output::Output(int fd) noexcept : fd(fd), out(this) {
+	setp(buffer, buffer + CAPACITY);
+}
+
+Output::Output(sink_t sink, void* data) noexcept : fd(-1), sink(sink), sink_data(data), out(this) {
+	setp(buffer, buffer + CAPACITY);
+}
+
+Output::Output(std::string& capture) noexcept : Output([](void* data, char const* bytes, size_t length) {
+	static_cast<std::string*>(data)->append(bytes, length);
+}, &capture) {}
+
+Output::~Output() {
+	flush();
+}
+
+Output& Output::standard() {
+	static Output output(STDOUT_FILENO);
+	return output;
+}
+
+void Output::write_all(char const* data, size_t length) {
+	if (sink) {
+		if (length != 0)
+			sink(sink_data, data, length);
+
+		return;
+	}
+
+	while (length != 0) {
+		auto written = ::write(fd, data, length);
+
+		if (written < 0) {
+			if (errno == EINTR)
+				continue;
+
+			return; // like `std::cout`, output errors are silently ignored.
+		}
+
+		data += written;
+		length -= written;
+	}
+}
+
+void Output::flush() {
+	write_all(pbase(), pptr() - pbase());
+	setp(buffer, buffer + CAPACITY);
+}
+
+void Output::write(std::string_view str) {
+	if (str.empty())
+		return; // `str.data()` may be null, which `memcpy` doesn't allow.
+
+	if ((size_t) (epptr() - pptr()) < str.length()) {
+		flush();
+
+		// Anything that wouldn't fit in the buffer anyways is written straight out.
+		if (CAPACITY <= str.length()) {
+			write_all(str.data(), str.length());
+			return;
+		}
+	}
+
+	std::memcpy(pptr(), str.data(), str.length());
+	pbump((int) str.length());
+}
+
+void Output::write(char chr) {
+	if (pptr() == epptr())
+		flush();
+
+	*pptr() = chr;
+	pbump(1);
+}
+
+void Output::write(number num) {
+	// `to_chars` needs enough room for the longest number.
+	if (epptr() - pptr() < 24)
+		flush();
+
+	auto end = std::to_chars(pptr(), epptr(), num).ptr;
+	pbump((int) (end - pptr()));
+}
+
+// Throws the error that converting `value` to a string would, if any of its elements can't be.
+static void check_elements(Value const& value) {
+	auto check = [](Value const& element) {
+		if (element.kind() == Value::Kind::List || element.kind() == Value::Kind::ListTree)
+			check_elements(element);
+		else if (element.kind() == Value::Kind::Variable || element.kind() == Value::Kind::Function)
+			throw Error("bad type for string conversion");
+	};
+
+	if (value.kind() == Value::Kind::List) {
+		auto elements = value.to_list();
+		for (auto const& element : *elements)
+			check(element);
+	} else {
+		value.each_element(check);
+	}
+}
+
+bool Output::write_value(Value const& value, bool last) {
+	switch (value.kind()) {
+	case Value::Kind::Null:
+		return false;
+
+	case Value::Kind::Boolean:
+		write(std::string_view(value.to_boolean() ? "true" : "false"));
+		return false;
+
+	case Value::Kind::Number:
+		write(value.to_number());
+		return false;
+
+	case Value::Kind::SmallString:
+	case Value::Kind::String:
+	case Value::Kind::Rope:
+	case Value::Kind::Slice:
+	case Value::Kind::Pending: {
+		// Ropes are written a piece at a time, so hold onto the last piece in case it ends in a backslash.
+		std::string_view tail;
+		value.each_chunk([&](std::string_view chunk) {
+			write(tail);
+			tail = chunk;
+		});
+
+		bool trim = last && !tail.empty() && tail.back() == '\\';
+		write(trim ? tail.substr(0, tail.length() - 1) : tail);
+		return trim;
+	}
+
+	case Value::Kind::List:
+	case Value::Kind::ListTree: {
+		// Lists are written like `to_string` would join them, with a newline between each element.
+		auto length = value.list_length();
+		size_t index = 0;
+		bool trimmed = false;
+
+		auto write_element = [&](Value const& element) {
+			if (index++ != 0)
+				write('\n');
+
+			trimmed = write_value(element, last && index == length);
+		};
+
+		// Flat lists are walked directly, which saves calling through a `std::function` per element.
+		if (value.kind() == Value::Kind::List) {
+			auto elements = value.to_list();
+			for (auto const& element : *elements)
+				write_element(element);
+		} else {
+			value.each_element(write_element);
+		}
+
+		return trimmed;
+	}
+
+	default:
+		throw Error("bad type for string conversion");
+	}
+}
+
+void Output::output(Value const& value) {
+	// Lists are written an element at a time, so they're checked first: nothing's written at all if
+	// any of them can't be converted.
+	if (value.kind() == Value::Kind::List || value.kind() == Value::Kind::ListTree)
+		check_elements(value);
+
+	if (!write_value(value, true))
+		write('\n');
+
+	flush_line();
+}
+
+Output::int_type Output::overflow(int_type chr) {
+	flush();
+
+	if (!traits_type::eq_int_type(chr, traits_type::eof()))
+		write(traits_type::to_char_type(chr));
+
+	return traits_type::not_eof(chr);
+}
+
+std::streamsize Output::xsputn(char const* data, std::streamsize length) {
+	write(std::string_view(data, length));
+	return length;
+}
+
+int Output::sync() {
+	flush();
+	return 0;
+}
+
+} // namespace kn
@@ -0,0 +1,100 @@
+#pragma once
+
+#include "value.hpp"
+
+#include <streambuf>
+#include <ostream>
+#include <string_view>
+#include <cstddef>
+
+namespace kn {
+
+// A large output buffer in front of a file descriptor or a callback, used by `O` and `D`.
+//
+// Rather than flushing after every line, output is written in blocks of `CAPACITY` bytes. The
+// buffer is also flushed before anything reads from stdin or runs a shell command, when the program
+// quits or errors, and on exit. When it's line buffered (`--line-buffered`), it's additionally
+// flushed after every `O` and `D`, for interactive use.
+//
+// It's a `streambuf` so that `operator<<` can write `Value`s into it too, via `stream()`.
+class Output final : public std::streambuf {
+public:
+	// How many bytes are buffered before they're written out.
+	static constexpr size_t CAPACITY = 64 * 1024;
+
+	// A function that output is passed to instead of being written to a file descriptor.
+	using sink_t = void (*)(void* data, char const* bytes, size_t length);
+
+private:
+	// Where the output is written to; `-1` when it's passed to `sink` instead.
+	int const fd;
+
+	// What output is passed to, along with `sink_data`, if there's no `fd`.
+	sink_t const sink = nullptr;
+	void* const sink_data = nullptr;
+
+	// Whether to flush after every `O` and `D`.
+	bool line_buffered = false;
+
+	// A stream which writes into this buffer.
+	std::ostream out;
+
+	char buffer[CAPACITY];
+
+	// Writes `length` bytes to `fd` (or `sink`), bypassing the buffer.
+	void write_all(char const* data, size_t length);
+
+	// Writes `value` converted to a string. If `last` is set and it ends in a backslash, the backslash
+	// is left off and `true` is returned.
+	bool write_value(Value const& value, bool last);
+
+protected:
+	int_type overflow(int_type chr) override;
+	std::streamsize xsputn(char const* data, std::streamsize length) override;
+	int sync() override;
+
+public:
+	explicit Output(int fd) noexcept;
+
+	// Passes all output to `sink`, along with `data`, in blocks of up to `CAPACITY` bytes.
+	Output(sink_t sink, void* data) noexcept;
+
+	// Appends all output to `capture`, which must outlive the output. (It's only up to date once the
+	// output's been flushed.)
+	explicit Output(std::string& capture) noexcept;
+	~Output() override;
+
+	Output(Output const&) = delete;
+	Output& operator=(Output const&) = delete;
+
+	// The buffer in front of stdout.
+	static Output& standard();
+
+	// Returns a stream that writes into this buffer.
+	std::ostream& stream() noexcept { return out; }
+
+	// Appends `str` to the buffer, writing the buffer out first if it's full.
+	void write(std::string_view str);
+	void write(char chr);
+	void write(number num);
+
+	// Writes `value` as `O` does: converted to a string and followed by a newline, unless it ends in a
+	// backslash, in which case the backslash is left off instead.
+	//
+	// Values are written straight into the buffer; lists in particular aren't joined into a string.
+	void output(Value const& value);
+
+	// Writes out everything that's been buffered.
+	void flush();
+
+	// Called after `O` and `D` finish writing, flushing the buffer if it's line buffered.
+	void flush_line() {
+		if (line_buffered)
+			flush();
+	}
+
+	// Sets whether to flush after every `O` and `D`.
+	void set_line_buffered(bool line_buffered) noexcept { this->line_buffered = line_buffered; }
+};
+
+} // namespace kn
@@ -0,0 +1,19 @@
+#include "pending.hpp"
+#include "command.hpp"
+
+namespace kn {
+
+// The background thread only ever touches the `Command` and the plain `string` it returns, never
+// anything refcounted, since `shared`'s refcounts aren't atomic.
+Pending::Pending(std::unique_ptr<Command> command)
+	: future(std::async(std::launch::async, [command = std::move(command)] { return command->finish(); }))
+{}
+
+shared<string> const& Pending::get() {
+	if (!output)
+		output = kn::make_shared<string>(future.get());
+
+	return *output;
+}
+
+} // namespace kn
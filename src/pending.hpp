@@ -0,0 +1,45 @@
+#pragma once
+
+#include "value.hpp"
+
+#include <future>
+#include <memory>
+#include <optional>
+
+namespace kn {
+
+class Command;
+
+// The output of a shell command that may still be running.
+//
+// When prefetching is enabled (`--async-commands`), `` ` `` returns one of these as soon as the
+// command's been started, and its output is collected on a background thread. The interpreter
+// only waits for the command the first time the string's contents are needed, so scripts that
+// start several commands before looking at their results run them concurrently.
+class Pending {
+	// The output being collected in the background.
+	std::future<string> future;
+
+	// The output, once it's been collected.
+	std::optional<shared<string>> output;
+
+	// Whether `` ` `` should return `Pending`s.
+	static inline bool enabled = false;
+
+public:
+	// Starts collecting the output of `command` on a background thread.
+	explicit Pending(std::unique_ptr<Command> command);
+
+	// Returns the command's output, waiting for it to finish if it hasn't yet.
+	//
+	// Any error that occurred whilst reading the output is rethrown here.
+	shared<string> const& get();
+
+	// Returns whether `` ` `` should return `Pending`s rather than waiting for commands to finish.
+	static bool is_enabled() noexcept { return enabled; }
+
+	// Sets whether `` ` `` should return `Pending`s.
+	static void set_enabled(bool enabled) noexcept { Pending::enabled = enabled; }
+};
+
+} // namespace kn
@@ -0,0 +1,105 @@
+#include "rope.hpp"
+
+namespace kn {
+
+Rope::~Rope() {
+	auto unique_rope = [](Value const& value) {
+		return value.kind() == Value::Kind::Rope && value.large.rope.unique();
+	};
+
+	if (!unique_rope(left) && !unique_rope(right))
+		return;
+
+	// Take the children of any rope we're the last owner of, so that when it's destroyed it
+	// doesn't have to recurse.
+	std::vector<Value> orphans;
+	orphans.push_back(std::move(left));
+	orphans.push_back(std::move(right));
+
+	while (!orphans.empty()) {
+		auto orphan = std::move(orphans.back());
+		orphans.pop_back();
+
+		if (unique_rope(orphan)) {
+			auto& rope = *orphan.large.rope;
+			orphans.push_back(std::move(rope.left));
+			orphans.push_back(std::move(rope.right));
+		}
+	}
+}
+
+// Copies both strings into a single new one.
+static Value flat_concat(Value const& lhs, Value const& rhs) {
+	auto lstr = lhs.as_string();
+	auto rstr = rhs.as_string();
+
+	string cat;
+	cat.reserve(lstr.length() + rstr.length());
+	cat.append(lstr);
+	cat.append(rstr);
+	return Value(std::move(cat));
+}
+
+Value Rope::concat(Value const& lhs, Value const& rhs) {
+	auto llen = lhs.string_length();
+	auto rlen = rhs.string_length();
+
+	if (rlen == 0)
+		return lhs;
+
+	if (llen == 0)
+		return rhs;
+
+	if (llen + rlen < MIN_LENGTH)
+		return flat_concat(lhs, rhs);
+
+	if (lhs.kind() == Value::Kind::Rope && rlen < LEAF_LENGTH) {
+		auto const& rope = *lhs.large.rope;
+		auto last = rope.right.kind();
+
+		if (last != Value::Kind::Null && last != Value::Kind::Rope
+				&& rope.right.string_length() + rlen <= LEAF_LENGTH)
+			return Value(kn::make_shared<Rope>(rope.left, flat_concat(rope.right, rhs), llen + rlen));
+	}
+
+	return Value(kn::make_shared<Rope>(lhs, rhs, llen + rlen));
+}
+
+Value const& Rope::flatten() {
+	if (right.kind() != Value::Kind::Null)  {
+		string flat;
+		flat.reserve(length);
+		each_chunk([&](std::string_view chunk) { flat.append(chunk); });
+
+		left = Value(kn::make_shared<string>(std::move(flat)));
+		right = Value();
+	}
+
+	return left;
+}
+
+void Rope::each_chunk(std::function<void(std::string_view)> const& func) const {
+	std::vector<Value const*> pending { &right, &left };
+
+	while (!pending.empty()) {
+		auto value = pending.back();
+		pending.pop_back();
+
+		switch (value->kind()) {
+		case Value::Kind::Null:
+			break;
+
+		case Value::Kind::Rope: {
+			auto const& rope = *value->large.rope;
+			pending.push_back(&rope.right);
+			pending.push_back(&rope.left);
+			break;
+		}
+
+		default:
+			func(value->as_string());
+		}
+	}
+}
+
+} // namespace kn
@@ -0,0 +1,49 @@
+#pragma once
+
+#include "value.hpp"
+
+namespace kn {
+
+// A string that's the concatenation of two other strings.
+//
+// Ropes are created by `+` when the result is large, so that repeatedly appending to a string
+// doesn't copy the whole thing every time. They're flattened into a contiguous `string` the first
+// time something needs the bytes (eg `G`, `S`, or comparisons); `O` and `D` can write them out
+// piece by piece instead.
+class Rope {
+	// The total length of the string.
+	size_t const length;
+
+	// The two halves of the string. Once flattened, `left` is the flat string and `right` is null.
+	Value left;
+	Value right;
+
+public:
+
+	// Results shorter than this are just copied into a new string.
+	static constexpr size_t MIN_LENGTH = 256;
+
+	// Short strings appended to a rope are merged into its last piece, up to this length, so that
+	// appending a character at a time doesn't create a new piece per character.
+	static constexpr size_t LEAF_LENGTH = 128;
+
+	Rope(Value left, Value right, size_t length) noexcept
+		: length(length), left(std::move(left)), right(std::move(right)) {}
+
+	// Ropes can be arbitrarily deep, so their children are released iteratively.
+	~Rope();
+
+	// Concatenates the two strings, creating a rope if the result is large enough.
+	static Value concat(Value const& lhs, Value const& rhs);
+
+	// Returns the total length of the string.
+	size_t size() const noexcept { return length; }
+
+	// Flattens the rope if needed, returning the flat string (which is always a `Kind::String`).
+	Value const& flatten();
+
+	// Calls `func` with each piece of the rope, in order.
+	void each_chunk(std::function<void(std::string_view)> const& func) const;
+};
+
+} // namespace kn
@@ -0,0 +1,102 @@
+#include "script.hpp"
+#include "function.hpp"
+#include "arena.hpp"
+
+#include <algorithm>
+
+namespace kn {
+
+Script::Frozen::~Frozen() {
+	for (auto object : objects)
+		delete object;
+}
+
+Script::Script(std::string_view source, Engine engine) : tree(compiler.parse(source)) {
+	if (engine == Engine::Vm)
+		compiled.emplace(Program::compile(tree));
+
+	freeze(tree);
+
+	// Constants are all part of the tree already, unless they were made by the compiler.
+	if (compiled) {
+		for (auto const& constant : compiled->constants)
+			freeze(constant);
+	}
+}
+
+void Script::freeze(Value const& value) {
+	// Objects are visited depth first, and each one is recorded after everything it refers to.
+	// Reversing that gives an order where nothing is deleted before anything that refers to it, as
+	// deleting an object reads the refcounts of its children.
+	struct Visit {
+		Value const* value;
+		RefCounted* finished; // set once `value`'s children have all been recorded.
+	};
+
+	std::vector<Visit> stack { { &value, nullptr } };
+	std::vector<RefCounted*> postorder;
+
+	while (!stack.empty()) {
+		auto visit = stack.back();
+		stack.pop_back();
+
+		if (visit.finished) {
+			postorder.push_back(visit.finished);
+			continue;
+		}
+
+		auto const& current = *visit.value;
+		RefCounted* header = nullptr;
+
+		switch (current.kind()) {
+		case Value::Kind::Null:
+		case Value::Kind::Boolean:
+		case Value::Kind::Number:
+		case Value::Kind::SmallString:
+		case Value::Kind::Variable:
+			break;
+
+		case Value::Kind::String:
+			header = current.large.str.make_immortal();
+			break;
+
+		case Value::Kind::List:
+			if ((header = current.large.lst.make_immortal())) {
+				stack.push_back({ nullptr, header });
+
+				for (auto const& element : *current.large.lst)
+					stack.push_back({ &element, nullptr });
+
+				continue;
+			}
+			break;
+
+		case Value::Kind::Function:
+			if ((header = current.large.func->arena.make_immortal())) {
+				stack.push_back({ nullptr, header });
+
+				// Nested functions are in the same arena, so only their other arguments need freezing.
+				current.large.func->arena.each([&](Function& func) {
+					for (size_t i = 0; i < func.arity; ++i)
+						if (func.args()[i].kind() != Value::Kind::Function)
+							stack.push_back({ &func.args()[i], nullptr });
+				});
+
+				continue;
+			}
+			break;
+
+		default:
+			// Parsing (and compiling) only ever produce the kinds above.
+			throw Error("cannot freeze value: " + std::to_string((int) current.kind()));
+		}
+
+		if (header)
+			postorder.push_back(header);
+	}
+
+	// Anything frozen later may refer to what's been frozen already, but not the other way around.
+	frozen.objects.insert(frozen.objects.begin(), postorder.rbegin(), postorder.rend());
+}
+
+} // namespace kn
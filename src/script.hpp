@@ -0,0 +1,56 @@
+#pragma once
+
+#include "interpreter.hpp"
+#include "vm.hpp"
+
+#include <optional>
+#include <vector>
+
+namespace kn {
+
+// A program that's been parsed (and compiled, for the VM) once, and can then be run by any number
+// of interpreters, including on several threads at once.
+//
+// Once it's parsed, everything the program refers to (the arena of its `Function` nodes, literals, and bytecode
+// constants) is made immortal, so running it never writes to their refcounts; nothing about the
+// script changes after it's been created. Its variables are resolved to slots when it's parsed,
+// and each interpreter running it keeps their values in its own slots (see `Interpreter::base`).
+//
+// Values produced by interpreters running the script may refer to its objects, so those
+// interpreters must be destroyed before the script is.
+class Script {
+	// The objects that were made immortal, which are deleted when the script is.
+	struct Frozen {
+		// Every object comes before the ones that it refers to, so they're deleted in order.
+		std::vector<RefCounted*> objects;
+
+		~Frozen();
+	};
+
+	// Declared first so that it's destroyed last, after everything that refers to its objects.
+	Frozen frozen;
+
+	// The interpreter that parsed the program, which owns its variables.
+	Interpreter compiler;
+
+	// The parsed program, and its bytecode if it's run by the VM.
+	Value tree;
+	std::optional<Program> compiled;
+
+	// Makes `value`, and everything it refers to, immortal.
+	void freeze(Value const& value);
+
+	// Interpreters run the script directly, and look up variables in `compiler`.
+	friend class Interpreter;
+
+public:
+	// Parses `source`, and compiles it when `engine` is the VM.
+	//
+	// Throws an `Error` if it can't be parsed.
+	explicit Script(std::string_view source, Engine engine = Engine::Tree);
+
+	Script(Script const&) = delete;
+	Script& operator=(Script const&) = delete;
+};
+
+} // namespace kn
@@ -0,0 +1,308 @@
+#include "server.hpp"
+#include "output.hpp"
+#include "input.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <optional>
+#include <sstream>
+#include <thread>
+#include <vector>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace kn {
+
+Server::Server(std::string path, Engine engine, Interpreter* prelude)
+	: path(std::move(path)), engine(engine), prelude(prelude)
+{
+	sockaddr_un address {};
+	address.sun_family = AF_UNIX;
+
+	if (sizeof(address.sun_path) <= this->path.length())
+		throw Error("socket path is too long: " + this->path);
+
+	std::memcpy(address.sun_path, this->path.c_str(), this->path.length() + 1);
+
+	listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (listener == -1)
+		throw Error("unable to create socket: " + std::string(std::strerror(errno)));
+
+	// A socket left behind by a previous server would otherwise stop us from binding.
+	struct stat info;
+	if (stat(this->path.c_str(), &info) == 0 && S_ISSOCK(info.st_mode))
+		unlink(this->path.c_str());
+
+	if (bind(listener, (sockaddr*) &address, sizeof(address)) == -1 || listen(listener, SOMAXCONN) == -1) {
+		auto message = std::string(std::strerror(errno));
+		close(listener);
+		throw Error("unable to listen on '" + this->path + "': " + message);
+	}
+
+	auto mapped = mmap(nullptr, sizeof(Latencies), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+	if (mapped == MAP_FAILED) {
+		close(listener);
+		unlink(this->path.c_str());
+		throw Error("unable to allocate latency statistics.");
+	}
+
+	latencies = new (mapped) Latencies();
+}
+
+Server::~Server() {
+	close(listener);
+	unlink(path.c_str());
+	latencies->~Latencies();
+	munmap(latencies, sizeof(Latencies));
+}
+
+// Reads exactly `length` bytes, returning `false` if the connection was closed (or broke) first.
+static bool read_exactly(int fd, void* data, size_t length) {
+	auto cursor = static_cast<char*>(data);
+
+	while (length != 0) {
+		auto amount = ::read(fd, cursor, length);
+
+		if (amount < 0 && errno == EINTR)
+			continue;
+
+		if (amount <= 0)
+			return false;
+
+		cursor += amount;
+		length -= amount;
+	}
+
+	return true;
+}
+
+// Reads a `uint32_t` length followed by that many bytes into `str`.
+static bool read_string(int fd, std::string& str) {
+	uint32_t length;
+
+	if (!read_exactly(fd, &length, sizeof(length)))
+		return false;
+
+	str.resize(length);
+	return read_exactly(fd, str.data(), length);
+}
+
+// Writes all of `data`, returning `false` if the connection was closed first.
+static bool write_all(int fd, std::string_view data) {
+	while (!data.empty()) {
+		// `MSG_NOSIGNAL`, so that clients going away don't kill the server with `SIGPIPE`.
+		auto written = send(fd, data.data(), data.length(), MSG_NOSIGNAL);
+
+		if (written < 0 && errno == EINTR)
+			continue;
+
+		if (written < 0)
+			return false;
+
+		data.remove_prefix(written);
+	}
+
+	return true;
+}
+
+// Appends `value`'s bytes to `response`.
+template<typename T>
+static void append(std::string& response, T value) {
+	response.append(reinterpret_cast<char const*>(&value), sizeof(value));
+}
+
+// Appends `str` to `response`, prefixed with its length.
+static void append_string(std::string& response, std::string_view str) {
+	append(response, (uint32_t) str.length());
+	response.append(str);
+}
+
+std::string Server::respond(std::string const& source, std::string const& input, Interpreter* interpreter) const {
+	std::string captured;
+	std::string error;
+	int32_t status = 0;
+
+	{
+		// A new interpreter's destroyed before its streams, and the output's flushed when it is.
+		Output output(captured);
+		Input in(input);
+		std::optional<Interpreter> fresh;
+
+		if (interpreter)
+			interpreter->redirect(output, in);
+		else
+			interpreter = &fresh.emplace(output, in);
+
+		try {
+			interpreter->play(source, engine);
+		} catch (Quit& quit) {
+			status = quit.status;
+		} catch (std::exception& err) {
+			status = 1;
+			error = err.what();
+		}
+	}
+
+	std::string response;
+	response.reserve(sizeof(int32_t) + 2 * sizeof(uint32_t) + captured.length() + error.length());
+	append(response, status);
+	append_string(response, captured);
+	append_string(response, error);
+	return response;
+}
+
+bool Server::respond_forked(int connection, std::string const& source, std::string const& input) const {
+	auto pid = fork();
+
+	if (pid == -1)
+		return false;
+
+	if (pid == 0) {
+		prelude->reseed();
+		_exit(write_all(connection, respond(source, input, prelude)) ? 0 : 1);
+	}
+
+	int status;
+	while (waitpid(pid, &status, 0) == -1) {
+		if (errno != EINTR)
+			return false;
+	}
+
+	// If it crashed, there's no telling how much of the response it sent.
+	return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+void Server::record(std::chrono::steady_clock::duration latency) {
+	auto micros = std::chrono::duration_cast<std::chrono::microseconds>(latency).count();
+	auto index = latencies->requests.fetch_add(1, std::memory_order_relaxed) % LATENCY_SAMPLES;
+
+	latencies->samples[index].store((uint32_t) std::min<decltype(micros)>(micros, UINT32_MAX), std::memory_order_relaxed);
+}
+
+std::string Server::statistics() const {
+	// Requests which finish whilst this is running may or may not be counted.
+	auto total = latencies->requests.load(std::memory_order_relaxed);
+	std::vector<uint32_t> sorted;
+
+	for (size_t i = 0; i < std::min(total, LATENCY_SAMPLES); ++i)
+		sorted.push_back(latencies->samples[i].load(std::memory_order_relaxed));
+
+	std::sort(sorted.begin(), sorted.end());
+
+	std::ostringstream out;
+	out << "requests: " << total << '\n';
+
+	if (sorted.empty())
+		return out.str();
+
+	for (double percentile : { 50.0, 90.0, 99.0, 99.9 }) {
+		auto index = std::min(sorted.size() - 1, (size_t) (percentile / 100 * sorted.size()));
+		out << 'p' << percentile << ": " << sorted[index] << "us\n";
+	}
+
+	out << "max: " << sorted.back() << "us\n";
+	return out.str();
+}
+
+void Server::serve(int connection) {
+	char type;
+	std::string source, input;
+
+	while (read_exactly(connection, &type, 1)) {
+		if (type == 'R') {
+			if (!read_string(connection, source) || !read_string(connection, input))
+				return;
+
+			auto started = std::chrono::steady_clock::now();
+
+			if (prelude) {
+				// The forked process sends the response itself.
+				if (!respond_forked(connection, source, input))
+					return;
+			} else if (!write_all(connection, respond(source, input, nullptr))) {
+				return;
+			}
+
+			record(std::chrono::steady_clock::now() - started);
+			continue;
+		}
+
+		if (type != 'S')
+			return; // the client's confused, so there's no telling where the next request starts.
+
+		std::string response;
+		append(response, (int32_t) 0);
+		append_string(response, statistics());
+		append_string(response, std::string_view());
+
+		if (!write_all(connection, response))
+			return;
+	}
+}
+
+void Server::work() {
+	while (true) {
+		int connection = accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+
+		if (connection == -1)
+			continue; // eg `EINTR`, or the client went away before it was accepted.
+
+		try {
+			serve(connection);
+		} catch (std::exception&) {
+			// eg a request too large to allocate; all that can be done is to drop the connection.
+		}
+
+		close(connection);
+	}
+}
+
+void Server::fork_connections() {
+	// Connections' processes are reaped automatically.
+	signal(SIGCHLD, SIG_IGN);
+
+	while (true) {
+		int connection = accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+
+		if (connection == -1)
+			continue;
+
+		if (fork() == 0) {
+			close(listener);
+			signal(SIGCHLD, SIG_DFL); // so that requests' processes can be waited for.
+
+			try {
+				serve(connection);
+			} catch (std::exception&) {
+				// as with `work`, all that can be done is to drop the connection.
+			}
+
+			_exit(0);
+		}
+
+		close(connection);
+	}
+}
+
+void Server::run(size_t workers) {
+	if (prelude) {
+		// The server never exits, so the prelude's output would otherwise never be written.
+		prelude->output().flush();
+		fork_connections();
+	}
+
+	// This thread works too, so one fewer needs to be started.
+	for (size_t i = 1; i < workers; ++i)
+		std::thread([this] { work(); }).detach();
+
+	work();
+}
+
+} // namespace kn
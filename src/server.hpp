@@ -0,0 +1,106 @@
+#pragma once
+
+#include "interpreter.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+namespace kn {
+
+// A daemon which runs Knight programs sent to it over a Unix socket (`--serve`).
+//
+// Keeping one process around means that requests don't pay for starting the interpreter. Each
+// request is still run in its own `Interpreter`, with its own variables and streams, which is
+// destroyed (freeing everything the program allocated) once the response has been sent.
+//
+// Requests are handled by a fixed pool of worker threads, each of which accepts a connection and
+// serves all of its requests before accepting the next. A connection can send any number of
+// requests, one after the other. All integers are in native byte order.
+//
+// Alternatively, the server can be a zygote (`--zygote`): given an interpreter that's already run a
+// prelude, it forks a process per connection, which in turn forks a process per request. Requests
+// then start with the prelude's variables (and the functions they refer to) already in place,
+// shared copy-on-write, and nothing a request does can affect the next one.
+//
+// Requests start with a single byte giving their type:
+// - `R`: runs a program. It's followed by the source code and then what its stdin should contain,
+//   each as a `uint32_t` length and then that many bytes.
+// - `S`: returns statistics about the latency of recent `R` requests, as the response's output.
+//
+// Responses are the program's exit status (an `int32_t`), then its stdout, then the error message
+// if it errored, each of the latter as a `uint32_t` length and then that many bytes.
+class Server {
+public:
+	// How many of the most recent requests' latencies are kept for statistics.
+	static constexpr size_t LATENCY_SAMPLES = 64 * 1024;
+
+private:
+	// How long each recent `R` request took, in microseconds.
+	//
+	// This is in shared memory, so that forked processes can record latencies too.
+	struct Latencies {
+		std::atomic<size_t> requests;
+
+		// A ring buffer, indexed by `requests`.
+		std::atomic<uint32_t> samples[LATENCY_SAMPLES];
+	};
+
+	// The socket that connections are accepted from.
+	int listener;
+
+	// The path that it's bound to.
+	std::string const path;
+
+	// How programs should be run.
+	Engine const engine;
+
+	// The interpreter that requests are forked from, if this is a zygote.
+	Interpreter* const prelude;
+
+	Latencies* latencies;
+
+	// Accepts and serves connections forever.
+	[[noreturn]] void work();
+
+	// Accepts connections forever, forking a process to serve each of them.
+	[[noreturn]] void fork_connections();
+
+	// Serves requests from `connection` until it's closed.
+	void serve(int connection);
+
+	// Runs `source` with `input` as its stdin, returning the response to send.
+	//
+	// The program is run in a new interpreter, unless `interpreter` is given.
+	std::string respond(std::string const& source, std::string const& input, Interpreter* interpreter) const;
+
+	// Runs `source` in a forked copy of `prelude`, which sends the response itself.
+	//
+	// Returns whether the response was sent.
+	bool respond_forked(int connection, std::string const& source, std::string const& input) const;
+
+	// Records how long a request took.
+	void record(std::chrono::steady_clock::duration latency);
+
+	// Returns the latency percentiles of recent requests, one per line.
+	std::string statistics() const;
+
+public:
+	// Starts listening on a Unix socket at `path`, replacing any stale socket that's already there.
+	//
+	// If `prelude` is given, requests are run in forked copies of it rather than in new interpreters.
+	//
+	// Throws an `Error` if the socket can't be created.
+	Server(std::string path, Engine engine, Interpreter* prelude = nullptr);
+	~Server();
+
+	Server(Server const&) = delete;
+	Server& operator=(Server const&) = delete;
+
+	// Serves requests with `workers` threads, or forked processes if this is a zygote (in which case
+	// `workers` is ignored). This never returns.
+	[[noreturn]] void run(size_t workers);
+};
+
+} // namespace kn
@@ -1,28 +1,110 @@
 #pragma once
 
-#include <memory>
+#include <utility>
+#include <cstddef>
 
 namespace kn {
 
+#ifdef KN_REFCOUNT_STATS
+// How much refcount traffic has occurred; `main` prints this out when the program exits.
+struct RefCountStats {
+	size_t allocations = 0;
+	size_t increments = 0;
+	size_t decrements = 0;
+};
+
+inline RefCountStats refcount_stats;
+# define KN_COUNT_REFCOUNT(field) (++refcount_stats.field)
+#else
+# define KN_COUNT_REFCOUNT(field) ((void) 0)
+#endif /* KN_REFCOUNT_STATS */
+
+// The header that precedes every object managed by `shared`.
+//
+// Each interpreter is single threaded, so the refcount is a plain integer rather than an atomic.
+// Objects that are shared between threads (see `Script`) are made immortal instead: their refcount
+// is set to `IMMORTAL` and never written to again, so that it's only ever read concurrently.
+//
+// The destructor is virtual so that a `shared<T>` can be copied and destroyed even when `T` is
+// incomplete (which is the case for `shared<Rope>` within `Value`).
+struct RefCounted {
+	static constexpr size_t IMMORTAL = ~(size_t) 0;
+
+	size_t refcount = 1;
+
+	virtual ~RefCounted() = default;
+};
+
 // My version of `shared_ptr`, except that the `==` operator acts on the values
-// themselves, not on the pointers
+// themselves, not on the pointers.
+//
+// The reference count is stored intrusively, in the same allocation as the value itself, so that
+// a `shared` is only a single pointer wide.
 template<typename T>
 class shared {
-	std::shared_ptr<T> ptr;
+	// The allocation that holds both the refcount and the value.
+	struct Box : RefCounted {
+		T value;
+
+		template<class... Args>
+		explicit Box(Args&&... args) : value(std::forward<Args>(args)...) {}
+	};
+
+	RefCounted* header;
+
+	explicit shared(RefCounted* header) noexcept : header(header) {}
+
+	template<class U, class... Args>
+	friend shared<U> make_shared(Args&&... args);
+
 public:
-	shared(std::shared_ptr<T> t) noexcept : ptr(t) {}
+	shared(shared const& rhs) noexcept : header(rhs.header) {
+		KN_COUNT_REFCOUNT(increments);
+
+		if (header->refcount != RefCounted::IMMORTAL)
+			++header->refcount;
+	}
+
+	shared(shared&& rhs) noexcept : header(std::exchange(rhs.header, nullptr)) {}
+
+	shared& operator=(shared rhs) noexcept {
+		std::swap(header, rhs.header);
+		return *this;
+	}
+
+	~shared() {
+		if (!header)
+			return;
+
+		KN_COUNT_REFCOUNT(decrements);
+		if (header->refcount != RefCounted::IMMORTAL && --header->refcount == 0)
+			delete header;
+	}
+
+	T& operator*() const noexcept { return static_cast<Box*>(header)->value; }
+	T* operator->() const noexcept { return &**this; }
+
+	bool ptr_eq(shared<T> const& rhs) const noexcept { return header == rhs.header; }
+
+	// Makes the object immortal, returning its header so that it can be deleted explicitly. If it's
+	// already immortal, `nullptr` is returned instead.
+	RefCounted* make_immortal() const noexcept {
+		if (header->refcount == RefCounted::IMMORTAL)
+			return nullptr;
 
-	T& operator*() const noexcept { return *ptr; }
-	T* operator->() const noexcept { return &*ptr; }
+		header->refcount = RefCounted::IMMORTAL;
+		return header;
+	}
 
-	bool ptr_eq(shared<T> const& rhs) const noexcept { return ptr == rhs.ptr; }
-	bool operator==(const shared<T>& rhs) const { return *ptr == *rhs; }
+	bool unique() const noexcept { return header->refcount == 1; }
+	bool operator==(const shared<T>& rhs) const { return ptr_eq(rhs) || **this == *rhs; }
 };
 
 // The equivalent of `std::make_shared` for `shared`.
 template<class T, class... Args>
 shared<T> make_shared( Args&&... args ) {
-	return shared(std::make_shared<T>(std::forward<Args>(args)...));
+	KN_COUNT_REFCOUNT(allocations);
+	return shared<T>(new typename shared<T>::Box(std::forward<Args>(args)...));
 }
 
 } // namespace kn
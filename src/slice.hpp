@@ -0,0 +1,43 @@
+#pragma once
+
+#include "value.hpp"
+
+namespace kn {
+
+// A substring of a heap-allocated string, sharing its storage.
+//
+// These are created by `G` and `]` so that walking along a string doesn't copy the remainder of it
+// each step. Short results are stored inline within `Value` instead, and slices that would only use
+// a small part of their buffer are copied, so that they don't keep the whole thing alive.
+class Slice {
+	// The string that's being borrowed from.
+	shared<string> buffer;
+
+	// The part of `buffer` this slice refers to.
+	std::string_view contents;
+
+public:
+
+	// Slices that are less than `1 / COMPACT_RATIO` of their buffer are copied instead.
+	static constexpr size_t COMPACT_RATIO = 4;
+
+	Slice(shared<string> buffer, std::string_view contents) noexcept
+		: buffer(std::move(buffer)), contents(contents) {}
+
+	// Returns the contents of the slice.
+	std::string_view view() const noexcept { return contents; }
+
+	// Returns the string that's being borrowed from.
+	shared<string> const& source() const noexcept { return buffer; }
+
+	// Returns `contents`, which must be a part of `buffer`, as a slice if it's worth making one.
+	static Value create(shared<string> const& buffer, std::string_view contents) {
+		if (contents.length() <= Value::SMALL_STRING_CAPACITY
+				|| contents.length() * COMPACT_RATIO < buffer->length())
+			return Value(contents);
+
+		return Value(kn::make_shared<Slice>(buffer, contents));
+	}
+};
+
+} // namespace kn
@@ -1,118 +1,322 @@
 #include "value.hpp"
 #include "variable.hpp"
 #include "function.hpp"
+#include "arena.hpp"
+#include "rope.hpp"
+#include "slice.hpp"
+#include "list_tree.hpp"
+#include "pending.hpp"
+#include "interpreter.hpp"
+#include "include/small_vector.hpp"
 #include <algorithm>
+#include <array>
+#include <charconv>
 #include <cmath>
 
 namespace kn {
 
-static void remove_keyword(std::string_view& view) {
-	do {
-		view.remove_prefix(1);
-	} while (std::isupper(view.front()) || view.front() == '_');
+// The classes of characters that the lexer distinguishes between.
+enum : uint8_t {
+	WHITESPACE = 1 << 0, // including parens and `:`, as per the Knight specs.
+	DIGIT = 1 << 1,
+	LOWER = 1 << 2,
+	UPPER = 1 << 3,
+	UNDERSCORE = 1 << 4,
+};
+
+// What each character begins, when it's the first character of a token.
+enum class Token : uint8_t {
+	Function, // or an invalid character, if the interpreter has no function by that name.
+	Whitespace,
+	Comment,
+	Null,
+	Boolean,
+	EmptyList,
+	String,
+	Number,
+	Identifier,
+};
+
+// The lexer's tables, indexed by character.
+struct Lexer {
+	std::array<uint8_t, 256> classes {};
+	std::array<Token, 256> tokens {};
+};
+
+static constexpr Lexer LEXER = [] {
+	Lexer lexer {};
+
+	for (char c : { ' ', '\t', '\n', '\r', '\v', '\f', '(', ')', ':' })
+		lexer.classes[(unsigned char) c] |= WHITESPACE;
+
+	for (int c = 0; c < 10; ++c)
+		lexer.classes['0' + c] |= DIGIT;
+
+	for (int c = 0; c < 26; ++c) {
+		lexer.classes['a' + c] |= LOWER;
+		lexer.classes['A' + c] |= UPPER;
+	}
+
+	lexer.classes['_'] |= UNDERSCORE;
+
+	for (size_t c = 0; c < 256; ++c) {
+		if (lexer.classes[c] & WHITESPACE)
+			lexer.tokens[c] = Token::Whitespace;
+		else if (lexer.classes[c] & DIGIT)
+			lexer.tokens[c] = Token::Number;
+		else if (lexer.classes[c] & (LOWER | UNDERSCORE))
+			lexer.tokens[c] = Token::Identifier;
+	}
+
+	lexer.tokens['#'] = Token::Comment;
+	lexer.tokens['N'] = Token::Null;
+	lexer.tokens['T'] = Token::Boolean;
+	lexer.tokens['F'] = Token::Boolean;
+	lexer.tokens['@'] = Token::EmptyList;
+	lexer.tokens['\''] = Token::String;
+	lexer.tokens['"'] = Token::String;
+
+	return lexer;
+}();
+
+// Removes characters from the start of `view` for as long as they're in one of `classes`.
+static void skip(std::string_view& view, uint8_t classes) {
+	size_t length = 0;
+
+	while (length < view.length() && (LEXER.classes[(unsigned char) view[length]] & classes))
+		++length;
+
+	view.remove_prefix(length);
 }
 
-std::optional<Value> Value::parse(std::string_view& view) {
-	char front;
+// Parses the next token from `view`: a literal, a variable, or a function whose arguments haven't
+// been parsed yet. Returns `nullopt` if there's nothing left.
+static std::optional<Value> parse_token(std::string_view& view, Interpreter& interpreter, Arena& arena) {
+	while (!view.empty()) {
+		char front = view.front();
 
-top:
+		switch (LEXER.tokens[(unsigned char) front]) {
+		case Token::Whitespace:
+			skip(view, WHITESPACE);
+			continue;
 
-	if (view.empty())
-		return std::nullopt;
+		case Token::Comment: {
+			auto newline = view.find('\n');
+			view.remove_prefix(newline == std::string_view::npos ? view.length() : newline);
+			continue;
+		}
 
-	// note that in knight, all forms of parens and `:` are considered whitespace.
-	switch (front = view.front()) {
-	case '#':
-		do {
+		case Token::Null:
 			view.remove_prefix(1);
-		} while (!view.empty() && view.front() != '\n');
-		goto top; // Next character is either whitespace or we're at eof.
+			skip(view, UPPER | UNDERSCORE);
+			return std::make_optional<Value>();
 
-	case ' ': case '\t': case '\n': case '\r': case '\v': case '\f':
-	case '(': case  ')': case ':': 
-		do {
+		case Token::Boolean:
 			view.remove_prefix(1);
-		} while (std::isspace(view.front()));
-		goto top;
+			skip(view, UPPER | UNDERSCORE);
+			return std::make_optional<Value>(front == 'T');
 
-	case 'N':
-		remove_keyword(view);
-		return std::make_optional<Value>();
+		case Token::EmptyList:
+			view.remove_prefix(1);
+			return std::make_optional<Value>(list());
 
-	case 'T':
-	case 'F':
-		remove_keyword(view);
-		return std::make_optional<Value>(front == 'T');
+		case Token::String: {
+			auto end = view.find(front, 1);
 
-	case '@':
-		view.remove_prefix(1);
-		return std::make_optional<Value>(list());
+			if (end == std::string_view::npos)
+				throw Error("unmatched quote encountered!");
 
-	case '\'':
-	case '\"': {
-		view.remove_prefix(1);
-		auto begin = view.cbegin();
+			auto str = view.substr(1, end - 1);
+			view.remove_prefix(end + 1);
 
-		for(char quote = front; quote != view.front(); view.remove_prefix(1))
-			if (view.empty())
-				throw Error("unmatched quote encountered!");
+			return std::make_optional<Value>(interpreter.intern(str));
+		}
+
+		case Token::Number: {
+			number num = 0;
+
+			for (; !view.empty() && (LEXER.classes[(unsigned char) view.front()] & DIGIT); view.remove_prefix(1))
+				num = num * 10 + (view.front() - '0');
 
-		string str(begin, view.cbegin());
-		view.remove_prefix(1);
+			return std::make_optional<Value>(num);
+		}
 
-		return std::make_optional<Value>(str);
+		case Token::Identifier: {
+			auto start = view;
+			skip(view, LOWER | UNDERSCORE | DIGIT);
+
+			auto name = start.substr(0, start.length() - view.length());
+			return std::make_optional<Value>(interpreter.lookup(name));
+		}
+
+		case Token::Function:
+			if (auto func = Function::parse(view, interpreter, arena))
+				return std::make_optional<Value>(func);
+
+			throw Error("invalid character encountered: " + std::to_string(front));
+		}
 	}
 
-	case '0': case '1': case '2': case '3': case '4':
-	case '5': case '6': case '7': case '8': case '9': {
-		number num = 0;
+	return std::nullopt;
+}
 
-		for (; std::isdigit(front = view.front()); view.remove_prefix(1))
-			num = num * 10 + (front - '0');
+std::optional<Value> Value::parse(std::string_view& view, Interpreter& interpreter, Arena& arena) {
+	// The functions whose arguments are still being parsed (and how many have been), innermost
+	// last. Nesting is tracked here rather than by recursing, so that arbitrarily deep programs (eg
+	// long chains of `;`) can be parsed without overflowing the stack.
+	itlib::small_vector<std::pair<Function*, uint32_t>, 32> unfinished;
 
-		return std::make_optional<Value>(num);
+	while (true) {
+		auto token = parse_token(view, interpreter, arena);
+
+		if (!token) {
+			if (unfinished.empty())
+				return std::nullopt;
+
+			throw Error("Cannot parse function.");
+		}
+
+		auto value = std::move(*token);
+
+		if (value.kind() == Kind::Function) {
+			auto func = value.large.func;
+
+			if (func->arity != 0) {
+				unfinished.emplace_back(func, 0);
+				continue;
+			}
+
+			value = func->finish(interpreter);
+		}
+
+		// Give the value to the innermost function, finishing it (and then its parent, and so on)
+		// if that was its last argument.
+		while (!unfinished.empty()) {
+			auto& [func, parsed] = unfinished.back();
+			arena.adopt(func->args()[parsed++], std::move(value));
+
+			if (parsed != func->arity)
+				break;
+
+			value = func->finish(interpreter);
+			unfinished.pop_back();
+		}
+
+		if (unfinished.empty())
+			return value;
 	}
+}
 
-	case 'a': case 'b': case 'c': case 'd': case 'e': case 'f': case 'g':
-	case 'h': case 'i': case 'j': case 'k': case 'l': case 'm': case 'n':
-	case 'o': case 'p': case 'q': case 'r': case 's': case 't': case 'u':
-	case 'v': case 'w': case 'x': case 'y': case 'z': case '_': {
-		auto start = view.cbegin();
+Value::Value(std::string_view str) noexcept {
+	if (str.length() <= SMALL_STRING_CAPACITY) {
+		new (&small) Small { Kind::SmallString, (uint8_t) str.length(), {} };
+		std::copy(str.cbegin(), str.cend(), small.chars);
+	} else {
+		new (&large) Large(Kind::String);
+		new (&large.str) shared<string>(kn::make_shared<string>(str));
+	}
+}
 
-		do {
-			view.remove_prefix(1);
-		} while (std::islower(front = view.front()) || front == '_' || std::isdigit(front));
+Value::Value(string str) noexcept {
+	if (str.length() <= SMALL_STRING_CAPACITY) {
+		new (&small) Small { Kind::SmallString, (uint8_t) str.length(), {} };
+		std::copy(str.cbegin(), str.cend(), small.chars);
+	} else {
+		new (&large) Large(Kind::String);
+		new (&large.str) shared<string>(kn::make_shared<string>(std::move(str)));
+	}
+}
 
-		auto name = std::string_view(start, view.cbegin() - start);
-		return std::make_optional<Value>(Variable::lookup(name));
+Value::Value(Variable var) noexcept : large(Kind::Variable) {
+	large.var = var.index;
+}
+
+void Value::retain(Function* func) noexcept {
+	func->arena.retain();
+}
+
+void Value::release(Function* func) noexcept {
+	func->arena.release();
+}
+
+size_t Value::string_length() const {
+	switch (kind()) {
+	case Kind::SmallString: return small.length;
+	case Kind::String: return large.str->length();
+	case Kind::Rope: return large.rope->size();
+	case Kind::Slice: return large.slice->view().length();
+	case Kind::Pending: return large.pending->get()->length();
+	default: throw Error("invalid kind for 'string_length'");
 	}
+}
 
-	default:
-		if (auto func = Function::parse(view))
-			return std::make_optional<Value>(*func);
+std::string_view Value::indirect_string() const {
+	if (kind() == Kind::Slice)
+		return large.slice->view();
+
+	if (kind() == Kind::Pending)
+		return *large.pending->get();
 
-		throw Error("invalid character encountered: " + std::to_string(front));
+	if (kind() == Kind::Rope)
+		return large.rope->flatten().as_string();
+
+	throw Error("invalid kind for 'as_string'");
+}
+
+shared<string> const& Value::string_buffer() const {
+	switch (kind()) {
+	case Kind::String: return large.str;
+	case Kind::Slice: return large.slice->source();
+	case Kind::Pending: return large.pending->get();
+	case Kind::Rope: return large.rope->flatten().large.str;
+	default: throw Error("invalid kind for 'string_buffer'");
 	}
 }
 
-template <typename... Fns>
-struct overload : Fns... { using Fns::operator()...; };
+Value Value::substring(size_t start, size_t length) const {
+	auto contents = as_string().substr(start, length);
 
-template <typename... Fns>
-overload(Fns...) -> overload<Fns...>;
+	if (kind() == Kind::SmallString)
+		return Value(contents);
+
+	return Slice::create(string_buffer(), contents);
+}
+
+void Value::each_chunk(std::function<void(std::string_view)> const& func) const {
+	if (kind() == Kind::Rope)
+		large.rope->each_chunk(func);
+	else
+		func(as_string());
+}
+
+void Value::each_element(std::function<void(Value const&)> const& func) const {
+	if (kind() == Kind::ListTree) {
+		large.tree->each(func);
+		return;
+	}
+
+	auto elements = to_list();
+	for (auto const& element : *elements)
+		func(element);
+}
 
 bool Value::to_boolean() const {
-	return std::visit(overload {
-		[](null) { return false; },
-		[](bool boolean) { return boolean; },
-		[](number num) { return num != 0; },
-		[](shared<string> const& str) { return str->length() != 0; },
-		[](shared<list> const& lst) { return lst->size() != 0; },
-		[](auto) -> bool { throw Error("bad type for boolean conversion"); }
-	}, data);
+	switch (kind()) {
+	case Kind::Null: return false;
+	case Kind::Boolean: return large.boolean;
+	case Kind::Number: return large.num != 0;
+	case Kind::SmallString: return small.length != 0;
+	case Kind::String: return large.str->length() != 0;
+	case Kind::Rope: return large.rope->size() != 0;
+	case Kind::Slice: return !large.slice->view().empty();
+	case Kind::Pending: return !large.pending->get()->empty();
+	case Kind::List: return large.lst->size() != 0;
+	case Kind::ListTree: return large.tree->size() != 0;
+	default: throw Error("bad type for boolean conversion");
+	}
 }
 
-static number string_to_number(string const& str) {
+static number string_to_number(std::string_view str) {
 	// a custom `stroll` that will will just stop at the first invalid character
 	number ret = 0;
 	auto begin = std::find_if_not(str.cbegin(), str.cend(), [](char c) { return std::isspace(c); });
@@ -132,90 +336,140 @@ static number string_to_number(string const& str) {
 }
 
 number Value::to_number() const {
-	return std::visit(overload {
-		[](null) { return (number) 0; },
-		[](bool boolean) { return (number) boolean; },
-		[](number num) { return num; },
-		[](shared<string> const& str) { return string_to_number(*str); },
-		[](shared<list> const& lst) { return (number) lst->size(); },
-		[](auto) -> number { throw Error("bad type for number conversion"); }
-	}, data);
+	switch (kind()) {
+	case Kind::Null: return 0;
+	case Kind::Boolean: return large.boolean;
+	case Kind::Number: return large.num;
+	case Kind::SmallString:
+	case Kind::String:
+	case Kind::Rope:
+	case Kind::Slice:
+	case Kind::Pending: return string_to_number(as_string());
+	case Kind::List:
+	case Kind::ListTree: return (number) list_length();
+	default: throw Error("bad type for number conversion");
+	}
 }
 
 static string join_list(list const& lst, std::string_view sep) {
 	string s;
 	bool start = true;
 
-	for (auto ele : lst) {
+	for (auto const& ele : lst) {
 		if (!start)
 			s.append(sep);
 		start = false;
-		s.append(*ele.to_string());
+		s.append(ele.to_string().as_string());
 	}
 
 	return s;
 }
 
-shared<string> Value::to_string() const {
-	static shared<string> null_string = kn::make_shared<string>("");
-	static shared<string> true_string = kn::make_shared<string>("true");
-	static shared<string> false_string = kn::make_shared<string>("false");
+Value Value::to_string() const {
+	switch (kind()) {
+	case Kind::Null: return Value(std::string_view(""));
+	case Kind::Boolean: return Value(std::string_view(large.boolean ? "true" : "false"));
+	case Kind::Number: {
+		char buf[24];
+		auto end = std::to_chars(buf, buf + sizeof(buf), large.num).ptr;
+		return Value(std::string_view(buf, end - buf));
+	}
 
-	return std::visit(overload {
-		[](null) { return null_string; },
-		[](bool boolean) { return boolean ? true_string : false_string; },
-		[](number num) { return kn::make_shared<string>(std::to_string(num)); },
-		[](shared<string> const& str) { return str; },
-		[](shared<list> const& lst) { return kn::make_shared<string>(join_list(*lst, std::string_view("\n"))); },
-		[](auto) -> shared<string> { throw Error("bad type for string conversion"); }
-	}, data);
+	case Kind::SmallString:
+	case Kind::String:
+	case Kind::Rope:
+	case Kind::Slice:
+	case Kind::Pending: return *this;
+	case Kind::List:
+	case Kind::ListTree: return Value(join_list(*to_list(), std::string_view("\n")));
+	default: throw Error("bad type for string conversion");
+	}
+}
+
+// Makes `lst` immortal, for lists that are shared by all threads.
+static shared<list> immortal(shared<list> lst) noexcept {
+	lst.make_immortal();
+	return lst;
 }
 
 shared<list> Value::to_list() const {
-	static auto empty_list = kn::make_shared<list>();
-	static auto true_list = kn::make_shared<list>(list{Value(true)});
-	static auto zero_list = kn::make_shared<list>(list{Value((number) 0)});
+	// These are shared by every thread, so they're immortal: their refcounts are never written to.
+	static auto const empty_list = immortal(kn::make_shared<list>());
+	static auto const true_list = immortal(kn::make_shared<list>(list{Value(true)}));
+	static auto const zero_list = immortal(kn::make_shared<list>(list{Value((number) 0)}));
+
+	switch (kind()) {
+	case Kind::Null: return empty_list;
+	case Kind::Boolean: return large.boolean ? true_list : empty_list;
+	case Kind::Number: {
+		if (large.num == 0) return zero_list;
+
+		list digits;
+		for (auto n = large.num; n != 0; n /= 10)
+			digits.push_back(Value(n % 10));
+
+		std::reverse(digits.begin(), digits.end());
+		digits.shrink_to_fit();
+		return kn::make_shared<list>(std::move(digits));
+	}
 
-	return std::visit(overload {
-		[](null) { return empty_list; },
-		[](bool boolean) { return boolean ? true_list : empty_list; },
-		[](number num) {
-			if (num == 0) return zero_list;
+	case Kind::SmallString:
+	case Kind::String:
+	case Kind::Rope:
+	case Kind::Slice:
+	case Kind::Pending: {
+		auto str = as_string();
+		if (str.length() == 0)
+			return empty_list;
 
-			list lst;
-			for (; num != 0; num /= 10)
-				lst.push_back(Value(num % 10));
+		list chars;
+		chars.reserve(str.length());
 
-			std::reverse(lst.begin(), lst.end());
-			lst.shrink_to_fit();
-			return kn::make_shared<list>(lst);
-		},
-		[](shared<string> const& str) {
-			if (str->length() == 0)
-				return empty_list;
+		for (auto chr : str)
+			chars.emplace_back(chr);
 
-			list lst;
-			lst.reserve(str->length());
+		return kn::make_shared<list>(std::move(chars));
+	}
 
-			for (auto chr : *str)
-				lst.push_back(Value(chr));
+	case Kind::List: return large.lst;
+	case Kind::ListTree: return kn::make_shared<list>(large.tree->flatten());
+	default: throw Error("bad type for list conversion");
+	}
+}
 
-			return kn::make_shared<list>(lst);
-		},
-		[](shared<list> const& lst) { return lst; },
-		[](auto) -> shared<list> { throw Error("bad type for list conversion"); }
-	}, data);
+size_t Value::list_length() const {
+	switch (kind()) {
+	case Kind::List: return large.lst->size();
+	case Kind::ListTree: return large.tree->size();
+	case Kind::SmallString:
+	case Kind::String:
+	case Kind::Rope:
+	case Kind::Slice:
+	case Kind::Pending: return string_length();
+	default: return to_list()->size();
+	}
 }
 
 std::ostream& operator<<(std::ostream& out, Value const& value) {
-	std::visit(overload {
-		[&](null) { out << "null"; }, 
-		[&](bool boolean) { out << (boolean ? "true" : "false"); },
-		[&](number num) { out << num; },
-		[&](shared<string> const& str) {
-			out << "\"";
-
-			for (auto chr : *str) {
+	switch (value.kind()) {
+	case Value::Kind::Null:
+		return out << "null";
+
+	case Value::Kind::Boolean:
+		return out << (value.large.boolean ? "true" : "false");
+
+	case Value::Kind::Number:
+		return out << value.large.num;
+
+	case Value::Kind::SmallString:
+	case Value::Kind::String:
+	case Value::Kind::Rope:
+	case Value::Kind::Slice:
+	case Value::Kind::Pending:
+		out << "\"";
+
+		value.each_chunk([&](std::string_view chunk) {
+			for (auto chr : chunk) {
 				switch (chr) {
 				case '\r': out << "\\r"; break;
 				case '\n': out << "\\n"; break;
@@ -230,126 +484,182 @@ std::ostream& operator<<(std::ostream& out, Value const& value) {
 					out << chr;
 				}
 			}
+		});
+
+		return out << "\"";
+
+	case Value::Kind::List:
+	case Value::Kind::ListTree: {
+		out << "[";
+		bool first = true;
+		value.each_element([&](Value const& ele) {
+			if (!first)
+				out << ", ";
+			first = false;
+			out << ele;
+		});
+		return out << "]";
+	}
 
-			out << "\"";
-		},
-		[&](shared<list> const& lst) {
-			out << "[";
-			bool first = true;
-			for (auto ele : *lst) {
-				if (!first)
-					out << ", ";
-				first = false;
-				out << ele;
-			}
-			out << "]";
-		},
-		[&](Variable* var) { out << *var; },
-		[&](shared<Function> const& func) { out << *func; },
-	}, value.data);
+	case Value::Kind::Variable:
+		return out << value.as_variable();
+
+	case Value::Kind::Function:
+		return out << *value.large.func;
+	}
 
 	return out;
 }
 
-Variable *Value::as_variable() const {
-	if (auto var = std::get_if<Variable*>(&data))
-		return *var;
+Variable Value::as_variable() const {
+	if (kind() == Kind::Variable)
+		return Variable(large.var);
 
 	throw Error("invalid kind for 'as_variable'");
 }
 
+Function *Value::as_function() const {
+	if (kind() == Kind::Function)
+		return large.func;
+
+	throw Error("invalid kind for 'as_function'");
+}
+
 Value Value::to_ascii() const {
-	if (auto chr = std::get_if<number>(&data)) {
-		if (*chr <= '\0' || '~' < *chr) throw Error("number is not valid ascii");
-		char c = (char) *chr; // cause of coercion nonsense
+	if (kind() == Kind::Number) {
+		if (large.num <= '\0' || '~' < large.num) throw Error("number is not valid ascii");
+		char c = (char) large.num; // cause of coercion nonsense
 		return Value(c);
 	}
 
-	if (auto str = std::get_if<shared<string>>(&data)) {
-		if (!(*str)->length())
+	if (is_string()) {
+		auto str = as_string();
+		if (!str.length())
 			throw Error("string is empty");
-		return Value((number) (**str)[0]);
+		return Value((number) str[0]);
 	}
 
 	throw Error("invalid kind for 'to_ascii'");
 }
 
 Value Value::get(size_t start, size_t length) const {
-	if (auto lst = std::get_if<shared<list>>(&data))
-		return Value(list((*lst)->cbegin() + start, (*lst)->cbegin() + start + length));
+	if (is_list())
+		return ListTree::get(*this, start, length);
 
-	if (auto str = std::get_if<shared<string>>(&data))
-		return Value((*str)->substr(start, length));
+	if (is_string())
+		return substring(start, length);
 
 	throw Error("invalid kind for get");
 }
 
-Value Value::set(size_t start, size_t length, Value replacement) const {
-	if (auto lst = std::get_if<shared<list>>(&data)) {
+Value Value::set(size_t start, size_t length, Value replacement) const& {
+	if (kind() == Kind::List) {
+		auto const& lst = *large.lst;
 		auto repl = replacement.to_list();
-		list res((*lst)->size() + repl->size() - length);
-		std::copy((*lst)->cbegin(), (*lst)->cbegin() + start, res.begin());
+		list res(lst.size() + repl->size() - length);
+		std::copy(lst.cbegin(), lst.cbegin() + start, res.begin());
 		std::copy(repl->cbegin(), repl->cend(), res.begin() + start);
-		std::copy((*lst)->cbegin() + start + length, (*lst)->cend(), res.begin() + start + repl->size());
-		return Value(res);
+		std::copy(lst.cbegin() + start + length, lst.cend(), res.begin() + start + repl->size());
+		return ListTree::create(std::move(res));
 	}
 
-	if (auto str = std::get_if<shared<string>>(&data)) {
-		auto repl = replacement.to_string();
+	if (kind() == Kind::ListTree) {
+		auto repl = replacement.is_list() ? std::move(replacement) : Value(replacement.to_list());
+		auto prefix = ListTree::get(*this, 0, start);
+		auto suffix = ListTree::get(*this, start + length, large.tree->size() - start - length);
+		return ListTree::concat(ListTree::concat(prefix, repl), suffix);
+	}
+
+	if (is_string()) {
+		auto str = as_string();
+		auto repl_value = replacement.to_string();
+		auto repl = repl_value.as_string();
 		string res;
-		res.reserve((*str)->length() + repl->length() - length);
-		res.append(**str, 0, start);
-		res.append(*repl);
-		res.append(**str, start + length, std::string::npos);
-		return Value(res);
+		res.reserve(str.length() + repl.length() - length);
+		res.append(str.substr(0, start));
+		res.append(repl);
+		res.append(str.substr(start + length));
+		return Value(std::move(res));
 	}
 
 	throw Error("invalid kind for set");
 }
 
+Value Value::set(size_t start, size_t length, Value replacement) && {
+	if (kind() == Kind::String && large.str.unique()) {
+		auto repl = replacement.to_string();
+		large.str->replace(start, length, repl.as_string());
+		return std::move(*this);
+	}
+
+	if (kind() == Kind::List && large.lst.unique()) {
+		auto& lst = *large.lst;
+		auto repl = replacement.to_list();
+
+		// Long lists are stored as trees, so it's only updated in place while it stays flat.
+		if (ListTree::FLAT_LENGTH < lst.size() - length + repl->size())
+			return static_cast<Value const&>(*this).set(start, length, Value(std::move(repl)));
+
+		if (repl->size() == length) {
+			std::copy(repl->cbegin(), repl->cend(), lst.begin() + start);
+		} else {
+			lst.erase(lst.cbegin() + start, lst.cbegin() + start + length);
+			lst.insert(lst.cbegin() + start, repl->cbegin(), repl->cend());
+		}
+
+		return std::move(*this);
+	}
+
+	return static_cast<Value const&>(*this).set(start, length, std::move(replacement));
+}
+
 
 Value Value::head() const {
-	if (auto lst = std::get_if<shared<list>>(&data)) {
-		if ((*lst)->size() == 0)
+	if (kind() == Kind::List) {
+		if (large.lst->size() == 0)
 			throw Error("head on empty list");
-		return (**lst)[0];
+		return (*large.lst)[0];
 	}
 
-	if (auto str = std::get_if<shared<string>>(&data)) {
-		if ((*str)->length() == 0)
+	if (kind() == Kind::ListTree)
+		return large.tree->at(0);
+
+	if (is_string()) {
+		auto str = as_string();
+		if (str.length() == 0)
 			throw Error("head on empty string");
-		return Value((**str)[0]);
+		return Value(str[0]);
 	}
 
 	throw Error("head on non-list non-string");
 }
 
 Value Value::tail() const {
-	if (auto lst = std::get_if<shared<list>>(&data)) {
-		auto iter = (*lst)->cbegin();
-		if (iter++ == (*lst)->cend())
+	if (kind() == Kind::List) {
+		auto const& lst = *large.lst;
+		if (lst.empty())
 			throw Error("tail on empty list");
-		return Value(list(iter, (*lst)->cend()));
+		return ListTree::get(*this, 1, lst.size() - 1);
 	}
 
-	if (auto str = std::get_if<shared<string>>(&data)) {
-		auto iter = (*str)->cbegin();
-		if (iter++ == (*str)->cend())
+	if (kind() == Kind::ListTree)
+		return ListTree::get(*this, 1, large.tree->size() - 1);
+
+	if (is_string()) {
+		if (string_length() == 0)
 			throw Error("tail on empty string");
-		return Value(string(iter, (*str)->cend()));
+		return substring(1, std::string::npos);
 	}
 
 	throw Error("tail on non-list non-string");
 }
 
-Value Value::run() {
-	if (auto var = std::get_if<Variable*>(&data))
-		return (*var)->run();
-
-	if (auto func = std::get_if<shared<Function>>(&data))
-		return (*func)->run();
-
-	return *this;
+Value Value::run() const {
+	switch (kind()) {
+	case Kind::Variable: return Variable(large.var).run();
+	case Kind::Function: return large.func->run();
+	default: return *this;
+	}
 }
 
 
@@ -357,126 +667,244 @@ Value Value::operator-() const {
 	return Value(-to_number());
 }
 
-Value Value::operator+(Value const& rhs) const {
-	if (auto str = std::get_if<shared<string>>(&data))
-		return Value(kn::make_shared<string>(**str + *rhs.to_string()));
+Value Value::operator+(Value const& rhs) const& {
+	switch (kind()) {
+	case Kind::SmallString:
+	case Kind::String:
+	case Kind::Rope:
+	case Kind::Slice:
+	case Kind::Pending:
+		return Rope::concat(*this, rhs.to_string());
+
+	case Kind::Number:
+		return Value(large.num + rhs.to_number());
 
-	if (auto num = std::get_if<number>(&data))
-		return Value(*num + rhs.to_number());
+	case Kind::List:
+	case Kind::ListTree:
+		if (rhs.is_list())
+			return ListTree::concat(*this, rhs);
 
-	if (auto lst = std::get_if<shared<list>>(&data)) {
+		return ListTree::concat(*this, Value(rhs.to_list()));
+
+	default:
+		throw Error("invalid kind given to '+'");
+	}
+}
+
+Value Value::operator+(Value const& rhs) && {
+	if (kind() == Kind::String && large.str.unique()) {
+		auto rstr = rhs.to_string();
+		large.str->append(rstr.as_string());
+		return std::move(*this);
+	}
+
+	if (kind() == Kind::List && large.lst.unique() && rhs.kind() != Kind::ListTree) {
 		auto rlist = rhs.to_list();
-		list cat;
-		cat.reserve((*lst)->size() + rlist->size());
-		cat.insert(cat.end(), (*lst)->begin(), (*lst)->end());
-		cat.insert(cat.end(), rlist->begin(), rlist->end());
-		return Value(kn::make_shared<list>(cat));
+
+		// Long lists are stored as trees, so it's only appended to in place while it stays flat.
+		if (ListTree::FLAT_LENGTH < large.lst->size() + rlist->size())
+			return ListTree::concat(*this, Value(std::move(rlist)));
+
+		// `rhs` may be this very list, in which case its elements are copied before appending them.
+		if (rlist.ptr_eq(large.lst))
+			rlist = kn::make_shared<list>(*rlist);
+
+		large.lst->insert(large.lst->end(), rlist->cbegin(), rlist->cend());
+		return std::move(*this);
 	}
 
-	throw Error("invalid kind given to '+'");
+	// Long lists are trees, which are appended to in place too when nothing else refers to them.
+	if (kind() == Kind::ListTree && rhs.kind() != Kind::ListTree) {
+		auto rlist = rhs.to_list();
+
+		if (ListTree::append(*this, *rlist))
+			return std::move(*this);
+
+		return ListTree::concat(*this, Value(std::move(rlist)));
+	}
+
+	return static_cast<Value const&>(*this) + rhs;
 }
 
 Value Value::operator-(Value const& rhs) const {
-	if (auto num = std::get_if<number>(&data))
-		return Value(*num - rhs.to_number());
+	if (kind() == Kind::Number)
+		return Value(large.num - rhs.to_number());
 
 	throw Error("invalid kind given to '-'");
 }
 
-Value Value::operator*(Value const& rhs) const {
+Value Value::operator*(Value const& rhs) const& {
 	number amount = rhs.to_number();
 
-	if (auto num = std::get_if<number>(&data))
-		return Value(*num * amount);
+	if (kind() == Kind::Number)
+		return Value(large.num * amount);
 
 	if (amount < 0)
 		throw Error("cannot replicate by a negative number");
 
-	if (auto lst = std::get_if<shared<list>>(&data)) {
-		list ret((*lst)->size() * amount);
+	if (is_list()) {
+		auto lst_ptr = to_list();
+		auto const& lst = *lst_ptr;
+
+		// Nothing's copied however many times an empty list is replicated.
+		if (lst.empty())
+			return Value(std::move(lst_ptr));
+
+		list ret(lst.size() * amount);
 		auto iter = ret.begin();
 
-		for (auto i = 0; i < amount; ++i)
-			iter = std::copy((*lst)->cbegin(), (*lst)->cend(), iter);
+		for (number i = 0; i < amount; ++i)
+			iter = std::copy(lst.cbegin(), lst.cend(), iter);
 
-		return Value(ret);
+		return ListTree::create(std::move(ret));
 	}
 
-	if (auto str = std::get_if<shared<string>>(&data)) {
+	if (is_string()) {
+		auto str = as_string();
+		if (str.empty())
+			return Value(str);
+
 		string ret;
-		ret.reserve((*str)->length() * amount);
+		ret.reserve(str.length() * amount);
 
-		for (auto i = 0; i < amount; ++i)
-			ret.append(**str);
+		for (number i = 0; i < amount; ++i)
+			ret.append(str);
 
-		return Value(ret);
+		return Value(std::move(ret));
 	}
 
 	throw Error("invalid kind given to '*'");
 }
 
+Value Value::operator*(Value const& rhs) && {
+	if ((kind() == Kind::String && large.str.unique()) || (kind() == Kind::List && large.lst.unique())) {
+		number amount = rhs.to_number();
+
+		// Long lists are stored as trees, so it's only replicated in place while it stays flat.
+		if (kind() == Kind::List && 0 < amount && ListTree::FLAT_LENGTH / amount < large.lst->size())
+			return static_cast<Value const&>(*this) * Value(amount);
+
+		if (amount < 0)
+			throw Error("cannot replicate by a negative number");
+
+		if (list_length() == 0)
+			return std::move(*this);
+
+		// Reserving up front means that the copies never reallocate what they're copying from.
+		if (kind() == Kind::String) {
+			auto& str = *large.str;
+			auto len = str.length();
+			str.reserve(len * amount);
+
+			for (number i = 1; i < amount; ++i)
+				str.append(str.data(), len);
+
+			str.resize(len * amount);
+		} else {
+			auto& lst = *large.lst;
+			auto len = lst.size();
+			lst.reserve(len * amount);
+
+			for (number i = 1; i < amount; ++i)
+				for (size_t j = 0; j < len; ++j)
+					lst.push_back(lst[j]);
+
+			lst.resize(len * amount);
+		}
+
+		return std::move(*this);
+	}
+
+	return static_cast<Value const&>(*this) * rhs;
+}
+
 Value Value::operator/(Value const& rhs) const {
-	if (auto lnum = std::get_if<number>(&data)) {
+	if (kind() == Kind::Number) {
 		auto rnum = rhs.to_number();
 
 		if (!rnum)
-			throw new Error("Cannot divide by zero");
+			throw Error("Cannot divide by zero");
 
-		return Value(*lnum / rnum);
+		return Value(large.num / rnum);
 	}
 
 	throw Error("invalid kind given to '/'");
 }
 
 Value Value::operator%(Value const& rhs) const {
-	if (auto lnum = std::get_if<number>(&data)) {
+	if (kind() == Kind::Number) {
 		auto rnum = rhs.to_number();
 		if (!rnum)
-			throw new Error("Cannot modulo by zero");
+			throw Error("Cannot modulo by zero");
 
-		return Value(*lnum % rnum);
+		return Value(large.num % rnum);
 	}
 
 	throw Error("invalid kind given to '%'");
 }
 
 Value Value::pow(Value const& rhs) const {
-	if (auto base = std::get_if<number>(&data))
-		return Value((number) std::pow(*base, rhs.to_number()));
+	if (kind() == Kind::Number)
+		return Value((number) std::pow(large.num, rhs.to_number()));
 
-	if (auto lst = std::get_if<shared<list>>(&data))
-		return Value(join_list(**lst, std::string_view(rhs.to_string()->data())));
+	if (is_list())
+		return Value(join_list(*to_list(), rhs.to_string().as_string()));
 
 	throw Error("invalid kind given to '^'");
 }
 
 bool Value::operator==(Value const& rhs) const {
-	return data == rhs.data;
+	if (is_string() && rhs.is_string())
+		return as_string() == rhs.as_string();
+
+	if (is_list() && rhs.is_list()) {
+		if (kind() == Kind::List && rhs.kind() == Kind::List)
+			return large.lst == rhs.large.lst;
+
+		return list_length() == rhs.list_length() && *to_list() == *rhs.to_list();
+	}
+
+	if (kind() != rhs.kind())
+		return false;
+
+	switch (kind()) {
+	case Kind::Null: return true;
+	case Kind::Boolean: return large.boolean == rhs.large.boolean;
+	case Kind::Number: return large.num == rhs.large.num;
+	case Kind::Variable: return large.var == rhs.large.var;
+	case Kind::Function: return large.func == rhs.large.func;
+	default: return false;
+	}
 }
 
 bool Value::operator<(Value const& rhs) const {
-	return std::visit([&](auto&& lhs) -> bool {
-		using T = std::decay_t<decltype(lhs)>;
-
-		if constexpr (std::is_same_v<T, number>) return lhs < rhs.to_number();
-		else if constexpr (std::is_same_v<T, shared<string>>) return *lhs < *rhs.to_string();
-		else if constexpr (std::is_same_v<T, shared<list>>) return *lhs < *rhs.to_list();
-		else if constexpr (std::is_same_v<T, bool>) return !lhs && rhs.to_boolean();
-		else throw Error("invalid kind given to '<'");
-	}, data);
+	switch (kind()) {
+	case Kind::Number: return large.num < rhs.to_number();
+	case Kind::SmallString:
+	case Kind::String:
+	case Kind::Rope:
+	case Kind::Slice:
+	case Kind::Pending: return as_string() < rhs.to_string().as_string();
+	case Kind::List:
+	case Kind::ListTree: return *to_list() < *rhs.to_list();
+	case Kind::Boolean: return !large.boolean && rhs.to_boolean();
+	default: throw Error("invalid kind given to '<'");
+	}
 }
 
 bool Value::operator>(Value const& rhs) const {
-	return std::visit([&](auto&& lhs) -> bool {
-		using T = std::decay_t<decltype(lhs)>;
-
-		if constexpr (std::is_same_v<T, number>) return lhs > rhs.to_number();
-		else if constexpr (std::is_same_v<T, shared<string>>) return *lhs > *rhs.to_string();
-		else if constexpr (std::is_same_v<T, shared<list>>) return *lhs > *rhs.to_list();
-		else if constexpr (std::is_same_v<T, bool>) return lhs && !rhs.to_boolean();
-		else throw Error("invalid kind given to '>'");
-	}, data);
+	switch (kind()) {
+	case Kind::Number: return large.num > rhs.to_number();
+	case Kind::SmallString:
+	case Kind::String:
+	case Kind::Rope:
+	case Kind::Slice:
+	case Kind::Pending: return as_string() > rhs.to_string().as_string();
+	case Kind::List:
+	case Kind::ListTree: return *to_list() > *rhs.to_list();
+	case Kind::Boolean: return large.boolean && !rhs.to_boolean();
+	default: throw Error("invalid kind given to '>'");
+	}
 }
 
 } // namespace kn
-
@@ -5,9 +5,11 @@
 
 #include <string>
 #include <string_view>
-#include <variant>
+#include <cstdint>
+#include <new>
 #include <ostream>
 #include <optional>
+#include <functional>
 #include <vector>
 
 namespace kn {
@@ -15,79 +17,300 @@ namespace kn {
 // Forward declarations.
 class Value;
 class Variable;
+class Interpreter;
 class Function;
+class Program;
+class Rope;
+class Slice;
+class Pending;
+class ListTree;
+class Arena;
 
 // Type definitions used internally.
 using number = long long;
 using string = std::string;
 using list = std::vector<Value>;
-using null = std::monostate;
 
 // The value type in Knight represents all the different types that can occur during
 // a knight program's execution.
+//
+// It's a 16 byte tagged union: numbers, booleans, null, and short strings are stored inline, and
+// everything else is a single (possibly refcounted) pointer.
 class Value {
-	std::variant<
-		null,
-		bool,
-		number,
-		shared<string>,
-		shared<list>,
-		Variable*,
-		shared<Function>
-	> data;
+public:
+	// The different kinds of values that exist.
+	enum class Kind : uint8_t {
+		Null,
+		Boolean,
+		Number,
+		SmallString,
+		String,
+		Rope,
+		Slice,
+		Pending,
+		List,
+		ListTree,
+		Variable,
+		Function,
+	};
+
+	// The longest string that's stored inline within a `Value`, without allocating.
+	static constexpr size_t SMALL_STRING_CAPACITY = 14;
+
+private:
+	// Small strings are their kind, their length, and then their contents.
+	struct Small {
+		Kind kind;
+		uint8_t length;
+		char chars[SMALL_STRING_CAPACITY];
+	};
+
+	// Every other kind is followed by a single word.
+	struct Large {
+		Kind kind;
+
+		union {
+			bool boolean;
+			number num;
+			shared<string> str;
+			shared<Rope> rope;
+			shared<Slice> slice;
+			shared<Pending> pending;
+			shared<list> lst;
+			shared<ListTree> tree;
+			size_t var; // the variable's slot.
+			Function* func; // refcounts its `Arena`, rather than the node itself.
+		};
+
+		explicit Large(Kind kind) noexcept : kind(kind) {}
+		~Large() {} // `Value` is responsible for destroying the active member.
+	};
+
+	// Both representations begin with their kind, so it can always be read through `large`.
+	union {
+		Small small;
+		Large large;
+	};
+
+	// The bytecode compiler needs to inspect the tree directly.
+	friend class Program;
+
+	// Ropes need to walk their children without flattening them.
+	friend class Rope;
+
+	// List trees need to read flat lists directly.
+	friend class ListTree;
+
+	// Scripts make the values they refer to immortal.
+	friend class Script;
 
 public:
 
 	// Constructors
-	explicit Value() noexcept : data(null {}) {}
-	explicit Value(bool boolean) noexcept : data(boolean) {}
-	explicit Value(number num) noexcept : data(num) {}
-	explicit Value(shared<string> str) noexcept : data(str) {}
-	explicit Value(shared<list> lst) noexcept : data(lst) {}
-	explicit Value(Variable* var) noexcept : data(var) {}
-	explicit Value(shared<Function> func) noexcept : data(func) {}
+	explicit Value() noexcept : large(Kind::Null) {}
+	explicit Value(bool boolean) noexcept : large(Kind::Boolean) { large.boolean = boolean; }
+	explicit Value(number num) noexcept : large(Kind::Number) { large.num = num; }
+	explicit Value(shared<string> str) noexcept : large(Kind::String) { new (&large.str) shared<string>(std::move(str)); }
+	explicit Value(shared<Rope> rope) noexcept : large(Kind::Rope) { new (&large.rope) shared<Rope>(std::move(rope)); }
+	explicit Value(shared<Slice> slice) noexcept : large(Kind::Slice) { new (&large.slice) shared<Slice>(std::move(slice)); }
+	explicit Value(shared<Pending> pending) noexcept : large(Kind::Pending) { new (&large.pending) shared<Pending>(std::move(pending)); }
+	explicit Value(shared<list> lst) noexcept : large(Kind::List) { new (&large.lst) shared<list>(std::move(lst)); }
+	explicit Value(shared<ListTree> tree) noexcept : large(Kind::ListTree) { new (&large.tree) shared<ListTree>(std::move(tree)); }
+	explicit Value(Variable var) noexcept;
+	explicit Value(Function* func) noexcept : large(Kind::Function) { large.func = func; retain(func); }
+
+	// Copying and moving only have to touch the refcount for the pointer kinds.
+	Value(Value const& rhs) noexcept : large(Kind::Null) { copy_payload(rhs); }
+	Value(Value&& rhs) noexcept : large(Kind::Null) { move_payload(std::move(rhs)); }
+	~Value() { destroy_payload(); }
+
+	Value& operator=(Value const& rhs) noexcept {
+		if (this != &rhs) {
+			destroy_payload();
+			copy_payload(rhs);
+		}
+
+		return *this;
+	}
+
+	Value& operator=(Value&& rhs) noexcept {
+		if (this != &rhs) {
+			destroy_payload();
+			move_payload(std::move(rhs));
+		}
+
+		return *this;
+	}
 
 	// Convenience constructors
-	explicit Value(char chr) noexcept : Value(kn::make_shared<string>(1, chr)) {}
-	explicit Value(string str) noexcept : Value(kn::make_shared<string>(str)) {}
-	explicit Value(list lst) noexcept : Value(kn::make_shared<list>(lst)) {}
+	explicit Value(char chr) noexcept : small { Kind::SmallString, 1, { chr } } {}
+	explicit Value(std::string_view str) noexcept;
+	explicit Value(string str) noexcept;
+	explicit Value(list lst) noexcept : Value(kn::make_shared<list>(std::move(lst))) {}
+
+	// Returns what kind of value this is.
+	Kind kind() const noexcept { return large.kind; }
 
-	// Parses a `Value` from the stream
-	static std::optional<Value> parse(std::string_view& view);
+	// Parses a `Value` from the stream, using `interpreter`'s variables and functions, and allocating
+	// any functions in `arena`.
+	static std::optional<Value> parse(std::string_view& view, Interpreter& interpreter, Arena& arena);
 
-	// Executes the value according to the `data` variant.
-	Value run();
+	// Executes the value according to its kind.
+	Value run() const;
 
 	// (dump only exists because i cant figure out how to get `operator<<` to be a friend)
 	friend std::ostream& operator<<(std::ostream& out, Value const& value);
 
 	// Type conversions. Throws errors for variables or functions.
+	//
+	// `to_string` always returns a `Value` that's a string, whose contents are accessed via `as_string`.
 	bool to_boolean() const;
 	number to_number() const;
-	shared<string> to_string() const;
+	Value to_string() const;
 	shared<list> to_list() const;
 
+	// Returns how many elements `to_list` would return, without converting to a list.
+	size_t list_length() const;
+
 	// Returns the internal variable. Throws an error if it's not a variable.
-	Variable* as_variable() const;
+	Variable as_variable() const;
+
+	// Returns the internal function. Throws an error if it's not a function.
+	Function* as_function() const;
+
+	// Returns the contents of this string. Throws an error if it's not a string.
+	std::string_view as_string() const {
+		if (kind() == Kind::SmallString)
+			return std::string_view(small.chars, small.length);
+
+		if (kind() == Kind::String)
+			return *large.str;
+
+		return indirect_string(); // also throws for non-strings.
+	}
+
+	// Calls `func` with each contiguous piece of this string, in order, without flattening ropes.
+	void each_chunk(std::function<void(std::string_view)> const& func) const;
+
+	// Calls `func` with each element of this list, in order, without flattening trees.
+	void each_element(std::function<void(Value const&)> const& func) const;
 
 	// Native Knight functions.
+	//
+	// The rvalue overloads of `set`, `+`, and `*` update strings and lists in place when nothing else
+	// refers to them.
 	Value get(size_t start, size_t length) const;
-	Value set(size_t start, size_t length, Value replacement) const;
+	Value set(size_t start, size_t length, Value replacement) const&;
+	Value set(size_t start, size_t length, Value replacement) &&;
 	Value head() const;
 	Value tail() const;
 	Value to_ascii() const;
 
 	// Native knight operators.
 	Value operator-() const;
-	Value operator+(Value const& rhs) const;
+	Value operator+(Value const& rhs) const&;
+	Value operator+(Value const& rhs) &&;
 	Value operator-(Value const& rhs) const;
-	Value operator*(Value const& rhs) const;
+	Value operator*(Value const& rhs) const&;
+	Value operator*(Value const& rhs) &&;
 	Value operator/(Value const& rhs) const;
 	Value operator%(Value const& rhs) const;
 	Value pow(Value const& rhs) const;
 	bool operator==(Value const& rhs) const;
 	bool operator<(Value const& rhs) const;
 	bool operator>(Value const& rhs) const;
+
+private:
+
+	bool is_string() const noexcept {
+		switch (kind()) {
+		case Kind::SmallString:
+		case Kind::String:
+		case Kind::Rope:
+		case Kind::Slice:
+		case Kind::Pending:
+			return true;
+		default:
+			return false;
+		}
+	}
+
+	bool is_list() const noexcept {
+		return kind() == Kind::List || kind() == Kind::ListTree;
+	}
+
+	// Returns the length of this string, without flattening it.
+	size_t string_length() const;
+
+	// Returns the contents of ropes (flattening them), slices, and pending command output (waiting
+	// for it).
+	std::string_view indirect_string() const;
+
+	// Returns the heap-allocated string that this string's contents are stored in.
+	shared<string> const& string_buffer() const;
+
+	// Returns `length` bytes of this string starting at `start`, sharing its storage if possible.
+	Value substring(size_t start, size_t length) const;
+
+	// Adds and drops references to the arena that `func` was allocated in.
+	static void retain(Function* func) noexcept;
+	static void release(Function* func) noexcept;
+
+	// Copies `rhs` into this value, which must not currently have an active payload.
+	void copy_payload(Value const& rhs) noexcept {
+		switch (rhs.kind()) {
+		case Kind::SmallString: new (&small) Small(rhs.small); return;
+		case Kind::String: new (&large) Large(Kind::String); new (&large.str) shared<string>(rhs.large.str); return;
+		case Kind::Rope: new (&large) Large(Kind::Rope); new (&large.rope) shared<Rope>(rhs.large.rope); return;
+		case Kind::Slice: new (&large) Large(Kind::Slice); new (&large.slice) shared<Slice>(rhs.large.slice); return;
+		case Kind::Pending: new (&large) Large(Kind::Pending); new (&large.pending) shared<Pending>(rhs.large.pending); return;
+		case Kind::List: new (&large) Large(Kind::List); new (&large.lst) shared<list>(rhs.large.lst); return;
+		case Kind::ListTree: new (&large) Large(Kind::ListTree); new (&large.tree) shared<ListTree>(rhs.large.tree); return;
+		case Kind::Function: new (&large) Large(Kind::Function); large.func = rhs.large.func; retain(large.func); return;
+		case Kind::Boolean: new (&large) Large(Kind::Boolean); large.boolean = rhs.large.boolean; return;
+		case Kind::Number: new (&large) Large(Kind::Number); large.num = rhs.large.num; return;
+		case Kind::Variable: new (&large) Large(Kind::Variable); large.var = rhs.large.var; return;
+		case Kind::Null: new (&large) Large(Kind::Null); return;
+		}
+	}
+
+	// Moves `rhs` into this value, which must not currently have an active payload.
+	//
+	// Moved-from values become null, so they don't have to worry about empty pointers.
+	void move_payload(Value&& rhs) noexcept {
+		switch (rhs.kind()) {
+		case Kind::String: new (&large) Large(Kind::String); new (&large.str) shared<string>(std::move(rhs.large.str)); break;
+		case Kind::Rope: new (&large) Large(Kind::Rope); new (&large.rope) shared<Rope>(std::move(rhs.large.rope)); break;
+		case Kind::Slice: new (&large) Large(Kind::Slice); new (&large.slice) shared<Slice>(std::move(rhs.large.slice)); break;
+		case Kind::Pending: new (&large) Large(Kind::Pending); new (&large.pending) shared<Pending>(std::move(rhs.large.pending)); break;
+		case Kind::List: new (&large) Large(Kind::List); new (&large.lst) shared<list>(std::move(rhs.large.lst)); break;
+		case Kind::ListTree: new (&large) Large(Kind::ListTree); new (&large.tree) shared<ListTree>(std::move(rhs.large.tree)); break;
+		case Kind::Function:
+			new (&large) Large(Kind::Function);
+			large.func = rhs.large.func;
+			new (&rhs.large) Large(Kind::Null); // the reference is stolen, rather than released.
+			return;
+		default: copy_payload(rhs); return; // nothing to steal from the inline kinds.
+		}
+
+		rhs.destroy_payload();
+		new (&rhs.large) Large(Kind::Null);
+	}
+
+	void destroy_payload() noexcept {
+		switch (kind()) {
+		case Kind::String: large.str.~shared(); break;
+		case Kind::Rope: large.rope.~shared(); break;
+		case Kind::Slice: large.slice.~shared(); break;
+		case Kind::Pending: large.pending.~shared(); break;
+		case Kind::List: large.lst.~shared(); break;
+		case Kind::ListTree: large.tree.~shared(); break;
+		case Kind::Function: release(large.func); break;
+		default: break;
+		}
+	}
 };
 
+static_assert(sizeof(Value) == 16, "Values should be a tag and a single word");
+
 } // namespace kn
@@ -1,47 +1,65 @@
 #pragma once
 
 #include "value.hpp"
+#include "interpreter.hpp"
 #include <optional>
 
 namespace kn {
 
 // A variable within Knight.
 //
-// As per the Knight specs, all variables are global.
+// As per the Knight specs, all variables are global. A `Variable` is only the index of its slot,
+// which is resolved when it's parsed; the value itself is stored in that slot of whichever
+// `Interpreter` is running, so that a parsed program can be run by several interpreters at once
+// (see `Script`). Its name is kept by the interpreter that parsed it, for errors and `DUMP`.
 class Variable {
-	// The name of the variable. This cannot be changed.
-	std::string const name;
+	// Where the variable's value is stored in an interpreter.
+	size_t index;
 
-	// The value associated with this variable.
-	std::optional<Value> value;
+	// Creates a Variable for the given slot.
+	explicit Variable(size_t index) noexcept : index(index) {}
 
-	// Creates a new Variable with the given name.
-	Variable(std::string name) noexcept : name(name) {};
+	// Variables are only created by looking them up in an interpreter, or by values and bytecode
+	// that were given them that way.
+	friend class Interpreter;
+	friend class Value;
+	friend class Program;
+
+	// Throws the error for running a variable that was never assigned.
+	[[noreturn]] void unassigned(Interpreter& interpreter) const;
 
 public:
 
 	// There is no default variable.
 	Variable() = delete;
 
-	// Looks up the variable associated with `name`, or creates it if it doesnt exist
-	static Variable* lookup(std::string_view name);
+	// Returns the slot that the variable's value is stored in.
+	size_t slot() const noexcept { return index; }
 
-	// Runs the variable, looking up its last assigned value.
+	// Runs the variable, looking up its last assigned value in `interpreter`.
 	//
 	// Throws an `Error` if the variable was never assigned.
-	Value run() const {
+	Value const& run(Interpreter& interpreter) const {
+		auto const& value = interpreter.slot(index);
+
 		if (!value)
-			throw Error("unknown variable encountered: " + name);
+			unassigned(interpreter);
 
 		return *value;
 	}
 
-	// Assigns a value to this variable, discarding its previous value.
-	void assign(Value newvalue) noexcept {
-		value = std::move(newvalue);
+	// Assigns a value to this variable in `interpreter`, discarding its previous value.
+	void assign(Interpreter& interpreter, Value newvalue) const noexcept {
+		interpreter.slot(index) = std::move(newvalue);
 	}
 
-	// Provides debugging output of this type.
+	// The same, but in the current interpreter.
+	Value const& run() const { return run(Interpreter::current()); }
+	void assign(Value newvalue) const noexcept { assign(Interpreter::current(), std::move(newvalue)); }
+
+	bool operator==(Variable rhs) const noexcept { return index == rhs.index; }
+
+	// Provides debugging output of this type, using the current interpreter's name for it.
  	friend std::ostream& operator<<(std::ostream& out, const Variable& s);
 };
 
@@ -0,0 +1,458 @@
+#include "vm.hpp"
+#include "function.hpp"
+#include "variable.hpp"
+#include "output.hpp"
+#include "interpreter.hpp"
+
+namespace kn {
+
+uint32_t Program::emit(Opcode opcode, uint32_t operand) {
+	code.push_back(Instruction { opcode, operand });
+	return (uint32_t) code.size() - 1;
+}
+
+uint32_t Program::add_constant(Value const& value) {
+	constants.push_back(value);
+	return (uint32_t) constants.size() - 1;
+}
+
+uint32_t Program::slot_operand(Value const& variable) {
+	auto slot = variable.as_variable().slot();
+
+	if (slot > UINT32_MAX)
+		throw Error("too many variables to compile.");
+
+	return (uint32_t) slot;
+}
+
+// Returns the opcode for `+`, `*`, and `S`, the functions which can update their first argument in
+// place.
+static std::optional<Opcode> in_place_opcode(char name) {
+	switch (name) {
+	case '+': return Opcode::Add;
+	case '*': return Opcode::Mul;
+	case 'S': return Opcode::Set;
+	default: return std::nullopt;
+	}
+}
+
+// Points the jump at `jump` to the next instruction that'll be emitted.
+void Program::patch(uint32_t jump) {
+	code[jump].operand = label = (uint32_t) code.size();
+}
+
+// Discards the result of the last instruction, folding the pop into it when possible.
+void Program::emit_pop() {
+	// If something jumps to the pop, it can't be merged into the previous instruction.
+	if (!code.empty() && label != code.size() && code.back().opcode == Opcode::StoreVariable)
+		code.back().opcode = Opcode::AssignVariable;
+	else
+		emit(Opcode::Pop);
+}
+
+void Program::compile_value(Value const& value, std::vector<Value>& pending) {
+	std::vector<Step> steps { Step { Step::Compile, Opcode::Pop, 0, &value } };
+
+	// Jumps that are waiting to be patched, and labels waiting to be jumped back to.
+	std::vector<uint32_t> jumps;
+
+	auto pop_jump = [&]() {
+		auto jump = jumps.back();
+		jumps.pop_back();
+		return jump;
+	};
+
+	while (!steps.empty()) {
+		auto step = steps.back();
+		steps.pop_back();
+
+		switch (step.kind) {
+		case Step::Compile:
+			if (step.value->kind() == Value::Kind::Variable)
+				emit(Opcode::LoadVariable, slot_operand(*step.value));
+			else if (step.value->kind() == Value::Kind::Function)
+				compile_function(*step.value->large.func, *step.value, steps, pending);
+			else
+				emit(Opcode::PushConstant, add_constant(*step.value));
+			break;
+
+		case Step::Emit:
+			emit(step.opcode, step.operand);
+			break;
+
+		case Step::Pop:
+			emit_pop();
+			break;
+
+		case Step::Label:
+			jumps.push_back((uint32_t) code.size());
+			break;
+
+		case Step::Jump:
+			jumps.push_back(emit(step.opcode));
+			break;
+
+		case Step::Patch:
+			patch(pop_jump());
+			break;
+
+		case Step::Else: {
+			auto end = emit(Opcode::Jump);
+			patch(pop_jump());
+			jumps.push_back(end);
+			break;
+		}
+
+		case Step::Loop: {
+			auto jump = pop_jump();
+			emit(Opcode::Jump, pop_jump());
+			patch(jump);
+			break;
+		}
+		}
+	}
+}
+
+void Program::compile_function(Function const& func, Value const& value, std::vector<Step>& steps,
+		std::vector<Value>& pending) {
+	auto args = func.args();
+
+	// Schedules `todo` to be done in order, before anything that was already scheduled.
+	auto then = [&](std::initializer_list<Step> todo) {
+		steps.insert(steps.end(), std::rbegin(todo), std::rend(todo));
+	};
+
+	auto compile = [](Value const& arg) { return Step { Step::Compile, Opcode::Pop, 0, &arg }; };
+	auto op = [](Opcode opcode, uint32_t operand = 0) { return Step { Step::Emit, opcode, operand }; };
+	auto jump = [](Opcode opcode) { return Step { Step::Jump, opcode }; };
+	Step const pop { Step::Pop }, label { Step::Label }, land { Step::Patch };
+	Step const otherwise { Step::Else }, loop { Step::Loop };
+
+	// Opcodes for functions whose arguments are all evaluated in order beforehand.
+	auto simple = [&](Opcode opcode) {
+		steps.push_back(op(opcode));
+
+		for (size_t i = func.arity; i != 0; --i)
+			steps.push_back(compile(args[i - 1]));
+	};
+
+	switch (func.name) {
+	case 'B':
+		if (args[0].kind() == Value::Kind::Function)
+			pending.push_back(args[0]);
+
+		emit(Opcode::PushConstant, add_constant(args[0]));
+		return;
+
+	case 'C':
+		return then({ compile(args[0]), op(Opcode::Call) });
+
+	case ';':
+		return then({ compile(args[0]), pop, compile(args[1]) });
+
+	case '=':
+		if (args[0].kind() == Value::Kind::Variable) {
+			auto variable = slot_operand(args[0]);
+			auto const& value = args[1];
+
+			// Like `Function::run_assigning`, `= v + v x` (and `*` and `S`) drop the variable's old
+			// value just before the operation, so that it can be updated in place.
+			if (value.kind() == Value::Kind::Function) {
+				auto const& update = *value.large.func;
+				auto opcode = in_place_opcode(update.name);
+
+				if (opcode && update.args()[0].kind() == Value::Kind::Variable
+						&& update.args()[0].large.var == args[0].large.var) {
+					then({
+						op(Opcode::ReleaseVariable, variable),
+						op(*opcode),
+						op(Opcode::StoreVariable, variable)
+					});
+
+					for (size_t i = update.arity; i != 0; --i)
+						steps.push_back(compile(update.args()[i - 1]));
+
+					return;
+				}
+			}
+
+			return then({ compile(value), op(Opcode::StoreVariable, variable) });
+		}
+
+		break; // let the tree walker raise the error.
+
+	case 'I':
+		return then({
+			compile(args[0]), jump(Opcode::JumpIfFalse),
+			compile(args[1]), otherwise,
+			compile(args[2]), land
+		});
+
+	case 'W':
+		return then({
+			label, compile(args[0]), jump(Opcode::JumpIfFalse),
+			compile(args[1]), pop, loop,
+			op(Opcode::PushConstant, add_constant(Value()))
+		});
+
+	case '&':
+	case '|':
+		return then({
+			compile(args[0]), jump(func.name == '&' ? Opcode::JumpIfFalseOr : Opcode::JumpIfTrueOr),
+			compile(args[1]), land
+		});
+
+	case 'Q': return simple(Opcode::Quit);
+	case '!': return simple(Opcode::Not);
+	case 'L': return simple(Opcode::Length);
+	case 'D': return simple(Opcode::Dump);
+	case 'O': return simple(Opcode::Output);
+	case 'A': return simple(Opcode::Ascii);
+	case '~': return simple(Opcode::Negate);
+	case ',': return simple(Opcode::Box);
+	case '[': return simple(Opcode::Head);
+	case ']': return simple(Opcode::Tail);
+	case '+': return simple(Opcode::Add);
+	case '-': return simple(Opcode::Sub);
+	case '*': return simple(Opcode::Mul);
+	case '/': return simple(Opcode::Div);
+	case '%': return simple(Opcode::Mod);
+	case '^': return simple(Opcode::Pow);
+	case '?': return simple(Opcode::Eql);
+	case '<': return simple(Opcode::Lth);
+	case '>': return simple(Opcode::Gth);
+	case 'G': return simple(Opcode::Get);
+	case 'S': return simple(Opcode::Set);
+	}
+
+	// Anything else is run via the tree walker.
+	emit(Opcode::RunTree, add_constant(value));
+}
+
+Program Program::compile(Value const& value) {
+	Program program(value);
+	std::vector<Value> pending;
+
+	program.compile_value(value, pending);
+	program.emit(Opcode::Return);
+
+	// Compile each block body into its own chunk. Bodies may contain more blocks, so loop until
+	// there's nothing left.
+	while (!pending.empty()) {
+		auto body = pending.back();
+		pending.pop_back();
+
+		auto& func = *body.large.func;
+		if (program.blocks.count(&func))
+			continue;
+
+		program.blocks.emplace(&func, (uint32_t) program.code.size());
+		program.compile_value(body, pending);
+		program.emit(Opcode::Return);
+	}
+
+	return program;
+}
+
+Value Program::run() const {
+	std::vector<Value> stack;
+	stack.reserve(256);
+	return execute(0, stack);
+}
+
+Value Program::execute(uint32_t ip, std::vector<Value>& stack) const {
+	auto pop = [&]() {
+		auto value = std::move(stack.back());
+		stack.pop_back();
+		return value;
+	};
+
+	// Hoisted out of the loop, as the compiler can't prove that pushing values doesn't modify them.
+	auto const* instructions = code.data();
+	auto* consts = constants.data();
+	auto& interpreter = Interpreter::current();
+
+	// Where the last `ReleaseVariable` was, and where the variable's old value is on the stack. If the
+	// in-place operation right after it fails, nothing was updated, so the variable gets it back.
+	uint32_t released = UINT32_MAX;
+	size_t released_at = 0;
+
+	try {
+		while (true) {
+			auto const& instr = instructions[ip++];
+
+			switch (instr.opcode) {
+			case Opcode::PushConstant:
+				stack.push_back(consts[instr.operand]);
+				break;
+
+			case Opcode::LoadVariable:
+				stack.push_back(Variable(instr.operand).run(interpreter));
+				break;
+
+			case Opcode::StoreVariable:
+				Variable(instr.operand).assign(interpreter, stack.back());
+				break;
+
+			case Opcode::AssignVariable:
+				Variable(instr.operand).assign(interpreter, std::move(stack.back()));
+				stack.pop_back();
+				break;
+
+			case Opcode::ReleaseVariable:
+				released = ip - 1;
+				released_at = stack.size() - (instructions[ip].opcode == Opcode::Set ? 4 : 2);
+				Variable(instr.operand).assign(interpreter, Value());
+				break;
+
+			case Opcode::Pop:
+				stack.pop_back();
+				break;
+
+			case Opcode::Jump:
+				ip = instr.operand;
+				break;
+
+			case Opcode::JumpIfFalse:
+				if (!stack.back().to_boolean())
+					ip = instr.operand;
+				stack.pop_back();
+				break;
+
+			case Opcode::JumpIfFalseOr:
+				if (!stack.back().to_boolean())
+					ip = instr.operand;
+				else
+					stack.pop_back();
+				break;
+
+			case Opcode::JumpIfTrueOr:
+				if (stack.back().to_boolean())
+					ip = instr.operand;
+				else
+					stack.pop_back();
+				break;
+
+			case Opcode::Call: {
+				auto block = pop();
+				decltype(blocks)::const_iterator chunk;
+
+				if (block.kind() == Value::Kind::Function && (chunk = blocks.find(block.large.func)) != blocks.cend())
+					stack.push_back(execute(chunk->second, stack));
+				else
+					stack.push_back(block.run());
+				break;
+			}
+
+			case Opcode::RunTree:
+				stack.push_back(consts[instr.operand].run());
+				break;
+
+			case Opcode::Return:
+				return pop();
+
+			case Opcode::Quit: {
+				auto status = pop().to_number();
+				interpreter.output().flush();
+				throw Quit { (int) status };
+			}
+
+			case Opcode::Not:
+				stack.back() = Value((bool) !stack.back().to_boolean());
+				break;
+
+			case Opcode::Length:
+				stack.back() = Value((number) stack.back().list_length());
+				break;
+
+			case Opcode::Dump: {
+				auto& output = interpreter.output();
+				output.stream() << stack.back();
+				output.flush_line();
+				break;
+			}
+
+			case Opcode::Output:
+				interpreter.output().output(stack.back());
+				stack.back() = Value();
+				break;
+
+			case Opcode::Ascii:
+				stack.back() = stack.back().to_ascii();
+				break;
+
+			case Opcode::Negate:
+				stack.back() = -stack.back();
+				break;
+
+			case Opcode::Box:
+				stack.back() = Value(list{stack.back()});
+				break;
+
+			case Opcode::Head:
+				stack.back() = stack.back().head();
+				break;
+
+			case Opcode::Tail:
+				stack.back() = stack.back().tail();
+				break;
+
+#define BINARY_OP(opcode, expr) \
+			case Opcode::opcode: { \
+				auto& lhs = stack[stack.size() - 2]; \
+				auto& rhs = stack.back(); \
+				lhs = expr; \
+				stack.pop_back(); \
+				break; \
+			}
+
+// Like `BINARY_OP`, except that two numbers are operated on in-place without going through `Value`.
+#define NUMERIC_OP(opcode, op, expr) \
+			case Opcode::opcode: { \
+				auto& lhs = stack[stack.size() - 2]; \
+				auto& rhs = stack.back(); \
+				if (lhs.kind() == Value::Kind::Number && rhs.kind() == Value::Kind::Number) \
+					lhs = Value(lhs.large.num op rhs.large.num); \
+				else \
+					lhs = expr; \
+				stack.pop_back(); \
+				break; \
+			}
+
+			NUMERIC_OP(Add, +, std::move(lhs) + rhs)
+			NUMERIC_OP(Sub, -, lhs - rhs)
+			NUMERIC_OP(Mul, *, std::move(lhs) * rhs)
+			BINARY_OP(Div, lhs / rhs)
+			BINARY_OP(Mod, lhs % rhs)
+			BINARY_OP(Pow, lhs.pow(rhs))
+			NUMERIC_OP(Eql, ==, Value(lhs == rhs))
+			NUMERIC_OP(Lth, <, Value(lhs < rhs))
+			NUMERIC_OP(Gth, >, Value(lhs > rhs))
+#undef NUMERIC_OP
+#undef BINARY_OP
+
+			case Opcode::Get: {
+				auto length = pop().to_number();
+				auto start = pop().to_number();
+				stack.back() = stack.back().get(start, length);
+				break;
+			}
+
+			case Opcode::Set: {
+				auto replacement = pop();
+				auto length = pop().to_number();
+				auto start = pop().to_number();
+				stack.back() = std::move(stack.back()).set(start, length, std::move(replacement));
+				break;
+			}
+			}
+		}
+	} catch (...) {
+		if (released != UINT32_MAX && ip == released + 2)
+			Variable(instructions[released].operand).assign(interpreter, std::move(stack[released_at]));
+
+		throw;
+	}
+}
+
+} // namespace kn
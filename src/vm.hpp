@@ -0,0 +1,108 @@
+#pragma once
+
+#include "value.hpp"
+#include "include/robin_hood_map.hpp"
+
+#include <vector>
+#include <cstdint>
+
+namespace kn {
+
+// The instructions understood by the bytecode VM.
+enum class Opcode : uint8_t {
+	// Stack and control flow.
+	PushConstant,  // pushes `constants[operand]`.
+	LoadVariable,  // pushes the value of the variable in slot `operand`.
+	StoreVariable, // assigns the top of the stack to the variable in slot `operand`, leaving it on the stack.
+	AssignVariable,// pops the top of the stack and assigns it to the variable in slot `operand`.
+	ReleaseVariable, // drops slot `operand`'s value, just before it's reassigned.
+	Pop,           // discards the top of the stack.
+	Jump,          // jumps to `operand`.
+	JumpIfFalse,   // pops the top of the stack, jumping to `operand` if it's falsey.
+	JumpIfFalseOr, // jumps to `operand` if the top of the stack is falsey, otherwise pops it. (`&`)
+	JumpIfTrueOr,  // jumps to `operand` if the top of the stack is truthy, otherwise pops it. (`|`)
+	Call,          // pops a block and pushes the result of running it. (`C`)
+	RunTree,       // pushes the result of walking `constants[operand]` with `Value::run`.
+	Return,        // stops execution of the current chunk.
+
+	// Builtin functions, which operate on already-evaluated arguments.
+	Quit, Not, Length, Dump, Output, Ascii, Negate, Box, Head, Tail,
+	Add, Sub, Mul, Div, Mod, Pow, Eql, Lth, Gth,
+	Get, Set,
+};
+
+// A single bytecode instruction.
+struct Instruction {
+	Opcode opcode;
+	uint32_t operand;
+};
+
+// A Knight program that's been lowered from its `Value` tree into flat bytecode.
+//
+// Control flow (`I`, `W`, `&`, `|`, `;`) becomes jumps, and blocks created via `B` are compiled
+// into their own chunks which `C` calls into. Functions the VM doesn't know how to lower (such as
+// `E` or ones added via `Interpreter::register_function`) are executed with the tree walker.
+class Program {
+	// The value this program was compiled from; kept so that all referenced nodes stay alive.
+	Value root;
+
+	// The bytecode itself; the main chunk starts at offset zero.
+	std::vector<Instruction> code;
+
+	// The constants (literals, blocks, and fallback nodes) referenced by `code`.
+	std::vector<Value> constants;
+
+	// The starting offset of each compiled block body, keyed by its `Function` node.
+	robin_hood::unordered_map<Function const*, uint32_t> blocks;
+
+	// The most recent jump target, which mustn't be merged with the instruction before it.
+	uint32_t label = 0;
+
+	explicit Program(Value root) noexcept : root(root) {}
+
+	uint32_t emit(Opcode opcode, uint32_t operand = 0);
+	uint32_t add_constant(Value const& value);
+	uint32_t slot_operand(Value const& variable);
+	void patch(uint32_t jump);
+	void emit_pop();
+	// A step of compiling a value. Nested values are compiled with an explicit stack of these rather
+	// than by recursing, so that arbitrarily deep programs can be compiled.
+	struct Step {
+		enum Kind : uint8_t {
+			Compile, // compiles `value`.
+			Emit,    // emits `opcode` with `operand`.
+			Pop,     // discards the last result (see `emit_pop`).
+			Label,   // records where the next instruction will be, for a later `Loop`.
+			Jump,    // emits a jump with `opcode`, recording it for a later `Patch` (or `Else`).
+			Patch,   // points the last recorded jump here.
+			Else,    // emits a jump, then points the last recorded jump here and records the new one.
+			Loop,    // jumps back to the last recorded label, and points the last recorded jump here.
+		} kind;
+
+		Opcode opcode = Opcode::Pop;
+		uint32_t operand = 0;
+		Value const* value = nullptr;
+	};
+
+	void compile_value(Value const& value, std::vector<Value>& pending);
+	void compile_function(Function const& func, Value const& value, std::vector<Step>& steps,
+		std::vector<Value>& pending);
+
+	Value execute(uint32_t ip, std::vector<Value>& stack) const;
+
+	// Scripts make the constants immortal.
+	friend class Script;
+
+public:
+
+	// Lowers the parsed `value` into bytecode.
+	static Program compile(Value const& value);
+
+	// Runs the program on a fresh stack, returning the result of the main chunk.
+	//
+	// This doesn't modify the program, so once its constants are immortal (see `Script`), it can
+	// be run on several threads at once.
+	Value run() const;
+};
+
+} // namespace kn
@@ -0,0 +1,82 @@
+/* Exercises `libknight.h`, printing what each call returns; `make test` compares it to `capi.out`. */
+#include "libknight.h"
+#include <stdio.h>
+#include <string.h>
+
+static void print_output(void *data, char const *bytes, size_t length) {
+	fprintf((FILE *) data, "output: %.*s", (int) length, bytes);
+}
+
+static kn_status run(kn_interpreter *interpreter, char const *source, kn_engine engine,
+		char const *input) {
+	kn_program *program;
+	kn_status status = kn_parse(interpreter, source, strlen(source), engine, &program);
+	if (status != KN_OK) {
+		printf("parse: %d (%s)\n", status, kn_last_error(interpreter));
+		return status;
+	}
+
+	int exit_status;
+	status = kn_run(interpreter, program, input, input ? strlen(input) : 0, print_output, stdout,
+		&exit_status);
+	if (status == KN_ERROR)
+		printf("run: %d (%s)\n", status, kn_last_error(interpreter));
+	else
+		printf("run: %d, exit status %d\n", status, exit_status);
+	kn_program_free(program);
+	return status;
+}
+
+static void print_variable(kn_interpreter *interpreter, char const *name) {
+	int64_t number;
+	kn_status status = kn_get_number(interpreter, name, &number);
+	if (status != KN_OK) {
+		printf("%s: %d (%s)\n", name, status, kn_last_error(interpreter));
+		return;
+	}
+
+	char *string;
+	size_t length;
+	status = kn_get_string(interpreter, name, &string, &length);
+	printf("%s: %d, %lld, \"%s\" (%zu bytes)\n", name, status, (long long) number, string, length);
+	kn_string_free(string);
+}
+
+int main(void) {
+	kn_engine const engines[] = { KN_ENGINE_TREE, KN_ENGINE_VM };
+
+	for (size_t i = 0; i < sizeof engines / sizeof *engines; i++) {
+		kn_interpreter *interpreter = kn_interpreter_new();
+		kn_interpreter *other = kn_interpreter_new();
+		printf("engine %d\n", engines[i]);
+
+		// Output, input and variables set from C.
+		kn_set_number(interpreter, "n", 41);
+		kn_set_string(interpreter, "s", "abc", 3);
+		run(interpreter, "; OUTPUT + n 1 ; OUTPUT + s PROMPT : = t * s 2", engines[i], "def\nghi");
+		print_variable(interpreter, "t");
+		print_variable(interpreter, "missing");
+
+		// `QUIT`, and errors while parsing and running.
+		run(interpreter, "; OUTPUT 'bye' QUIT 3", engines[i], NULL);
+		run(interpreter, "+ 1", engines[i], NULL);
+		run(interpreter, "OUTPUT unassigned", engines[i], NULL);
+
+		// A failed update in place leaves the variable as it was.
+		kn_set_string(interpreter, "x", "abc", 3);
+		run(interpreter, "= x * x ~1", engines[i], NULL);
+		print_variable(interpreter, "x");
+
+		// Programs only run with the interpreter that parsed them.
+		kn_program *program;
+		kn_parse(interpreter, "OUTPUT n", 8, engines[i], &program);
+		kn_status status = kn_run(other, program, NULL, 0, print_output, stdout, NULL);
+		printf("other interpreter: %d (%s)\n", status, kn_last_error(other));
+		kn_program_free(program);
+
+		kn_interpreter_free(other);
+		kn_interpreter_free(interpreter);
+	}
+
+	return 0;
+}
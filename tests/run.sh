@@ -0,0 +1,37 @@
+#!/bin/sh
+# Runs each `*.kn` program here with the `knight` given as `$1`, under both engines and with folding
+# disabled, checking that it prints exactly what's in the `.out` file next to it without crashing.
+# A program's stdin is its `.in` file (if any), given both as a file and as a pipe since `PROMPT`
+# reads them differently, and any flags it needs are in its `.flags` file.
+knight=$1
+dir=$(dirname "$0")
+output=$(mktemp)
+trap 'rm -f "$output"' EXIT
+failed=0
+
+check() {
+	status=$?
+	if [ $status -ge 128 ] || ! cmp -s "$output" "$base.out"; then
+		echo "failed: $test $*"
+		failed=1
+	fi
+}
+
+for test in "$dir"/*.kn; do
+	base=${test%.kn}
+	flags=$(cat "$base.flags" 2>/dev/null)
+
+	for config in "" --engine=vm --no-fold; do
+		if [ -f "$base.in" ]; then
+			"$knight" $config $flags -f "$test" <"$base.in" >"$output" 2>/dev/null
+			check $config $flags
+			cat "$base.in" | "$knight" $config $flags -f "$test" >"$output" 2>/dev/null
+			check $config $flags "(piped)"
+		else
+			"$knight" $config $flags -f "$test" </dev/null >"$output" 2>/dev/null
+			check $config $flags
+		fi
+	done
+done
+
+exit $failed